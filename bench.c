@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 7992
+#define BUFFER_SIZE 4096
+#define TOKEN_LENGTH 64
+#define DEFAULT_CLIENTS 20
+#define SETUP_CONCURRENCY 8 // clients creating accounts at the same time
+#define MAX_BUSY_RETRIES 20
+#define THREAD_STACK_SIZE (256 * 1024)
+
+// struct that keeps state of one simulated client
+typedef struct
+{
+    int id;
+    char login[64];
+    char password[64];
+    char token[TOKEN_LENGTH + 1];
+    bool use_token;
+    bool drop;        // leave connection open without logging out
+    int stale_socket; // connection left open by the previous phase (-1 if none)
+    bool ok;
+    int busy;            // how many times server answered BUSY
+    bool connect_failed; // connection refused or timed out
+    bool failed;         // login failed for other reason (wrong answer, connection closed)
+    double latency_ms;
+    pthread_t thread_id;
+} bench_client;
+
+// global vars:
+char *server_ip = SERVER_IP;
+int server_port = SERVER_PORT;
+
+// honor retry hints sent by busy server
+bool follow_hints = true;
+
+// all clients of a phase wait here and start at once
+pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+bool started = false;
+
+// limit of clients logging in at the same time (0 - no limit)
+int concurrency_limit = 0;
+int active_clients = 0;
+
+// current monotonic time in milliseconds
+double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// connect to the server, returns socket or -1
+int connect_to_server()
+{
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd < 0)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(server_port);
+    inet_pton(AF_INET, server_ip, &server_addr.sin_addr);
+
+    if (connect(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+// result of one connection attempt
+typedef enum
+{
+    ATTEMPT_OK,
+    ATTEMPT_FAILED,
+    ATTEMPT_BUSY
+} attempt_result;
+
+// find complete line "BUSY <retry_after_ms> <jitter_ms> ..." in received data,
+// it can come after login prompts (they don't end with newline)
+char *find_busy_line(char *data)
+{
+    char *line = data;
+    while (line)
+    {
+        if (strncmp(line, "BUSY ", 5) == 0 && strchr(line, '\n'))
+        {
+            return line;
+        }
+        line = strchr(line, '\n');
+        if (line)
+        {
+            line++;
+        }
+    }
+    return NULL;
+}
+
+// connect and log in (with password or token), read new session token and log out
+// when server is busy, delay before next attempt is written to retry_ms
+attempt_result login_attempt(bench_client *client, unsigned int *retry_ms)
+{
+    int socket_fd = connect_to_server();
+    if (socket_fd < 0)
+    {
+        client->connect_failed = true;
+        return ATTEMPT_FAILED;
+    }
+
+    // answers to login (and password) prompts are sent at once
+    char request[BUFFER_SIZE];
+    if (client->use_token)
+    {
+        snprintf(request, BUFFER_SIZE, "t %s %s\n", client->login, client->token);
+    }
+    else
+    {
+        snprintf(request, BUFFER_SIZE, "%s\n%s\n", client->login, client->password);
+    }
+    send(socket_fd, request, strlen(request), 0);
+
+    // wait for the session token
+    attempt_result result = ATTEMPT_FAILED;
+    char buffer[BUFFER_SIZE * 2];
+    size_t length = 0;
+    while (length < sizeof(buffer) - 1)
+    {
+        int bytes_received = recv(socket_fd, buffer + length, sizeof(buffer) - 1 - length, 0);
+        if (bytes_received <= 0)
+        {
+            break;
+        }
+        length += bytes_received;
+        buffer[length] = '\0';
+
+        // server is busy: "BUSY <retry_after_ms> <jitter_ms> ..."
+        unsigned int jitter_ms;
+        char *busy = find_busy_line(buffer);
+        if (busy && sscanf(busy, "BUSY %u %u", retry_ms, &jitter_ms) == 2)
+        {
+            *retry_ms += jitter_ms > 0 ? rand() % (jitter_ms + 1) : 0;
+            result = ATTEMPT_BUSY;
+            break;
+        }
+
+        char *token = strstr(buffer, "Token sesji: ");
+        if (token && strlen(token + 13) >= TOKEN_LENGTH)
+        {
+            memcpy(client->token, token + 13, TOKEN_LENGTH);
+            client->token[TOKEN_LENGTH] = '\0';
+            result = ATTEMPT_OK;
+            break;
+        }
+    }
+
+    // connection is left without logging out, like after a network failure that
+    // the server didn't notice yet, so the session is still logged in for next phase
+    if (result == ATTEMPT_OK && client->drop)
+    {
+        client->stale_socket = socket_fd;
+        return result;
+    }
+
+    // log out and wait until server closes the connection, so the account is free for next phase
+    if (result == ATTEMPT_OK)
+    {
+        send(socket_fd, "q\n", 2, 0);
+        while (recv(socket_fd, buffer, sizeof(buffer), 0) > 0)
+        {
+        }
+    }
+    close(socket_fd);
+    return result;
+}
+
+// thread of one simulated client, retries while server answers BUSY
+void *login_once(void *arg)
+{
+    bench_client *client = (bench_client *)arg;
+    client->ok = false;
+    client->busy = 0;
+    client->connect_failed = false;
+    client->failed = false;
+
+    pthread_mutex_lock(&start_mutex);
+    while (!started)
+    {
+        pthread_cond_wait(&start_cond, &start_mutex);
+    }
+    pthread_mutex_unlock(&start_mutex);
+
+    // wait for free slot when concurrency is limited
+    pthread_mutex_lock(&start_mutex);
+    while (concurrency_limit > 0 && active_clients >= concurrency_limit)
+    {
+        pthread_cond_wait(&start_cond, &start_mutex);
+    }
+    active_clients++;
+    pthread_mutex_unlock(&start_mutex);
+
+    double start = now_ms();
+    unsigned int retry_ms = 0;
+    attempt_result result;
+    while ((result = login_attempt(client, &retry_ms)) == ATTEMPT_BUSY && client->busy < MAX_BUSY_RETRIES)
+    {
+        client->busy++;
+        if (follow_hints)
+        {
+            usleep(retry_ms * 1000);
+        }
+    }
+
+    if (result == ATTEMPT_OK)
+    {
+        client->ok = true;
+        client->latency_ms = now_ms() - start;
+    }
+    else if (result == ATTEMPT_FAILED && !client->connect_failed)
+    {
+        client->failed = true;
+    }
+
+    pthread_mutex_lock(&start_mutex);
+    active_clients--;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_mutex);
+    return NULL;
+}
+
+// compare function for sorting latencies
+int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// reset connections left open by clients (SO_LINGER 0 sends RST instead of FIN)
+void reset_stale_connections(bench_client *clients, int num_of_clients)
+{
+    struct linger linger = {1, 0};
+    for (int i = 0; i < num_of_clients; i++)
+    {
+        if (clients[i].stale_socket >= 0)
+        {
+            setsockopt(clients[i].stale_socket, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+            close(clients[i].stale_socket);
+            clients[i].stale_socket = -1;
+        }
+    }
+}
+
+// run all clients at once and print login throughput
+void run_phase(const char *name, bench_client *clients, int num_of_clients, bool use_token, bool drop,
+               int concurrency)
+{
+    started = false;
+    concurrency_limit = concurrency;
+    // many clients, small stacks
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    for (int i = 0; i < num_of_clients; i++)
+    {
+        clients[i].use_token = use_token;
+        clients[i].drop = drop;
+        if (pthread_create(&clients[i].thread_id, &attr, login_once, &clients[i]) != 0)
+        {
+            fprintf(stderr, "Nie można utworzyć wątku klienta %d\n", i);
+            exit(1);
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    double start = now_ms();
+    pthread_mutex_lock(&start_mutex);
+    started = true;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_mutex);
+
+    for (int i = 0; i < num_of_clients; i++)
+    {
+        pthread_join(clients[i].thread_id, NULL);
+    }
+    double elapsed = now_ms() - start;
+
+    double *latencies = malloc(num_of_clients * sizeof(double));
+    int ok = 0, busy = 0, busy_clients = 0, connect_failed = 0, failed = 0;
+    for (int i = 0; i < num_of_clients; i++)
+    {
+        if (clients[i].ok)
+        {
+            latencies[ok++] = clients[i].latency_ms;
+        }
+        busy += clients[i].busy;
+        busy_clients += clients[i].busy > 0;
+        connect_failed += clients[i].connect_failed;
+        failed += clients[i].failed;
+    }
+    qsort(latencies, ok, sizeof(double), compare_double);
+
+    printf("%s\n  udane: %d/%d  czas: %.1f ms  logowań/s: %.1f", name, ok, num_of_clients,
+           elapsed, ok * 1000.0 / elapsed);
+    if (ok > 0)
+    {
+        printf("  p50: %.1f ms  p99: %.1f ms  max: %.1f ms", latencies[ok / 2], latencies[(ok * 99) / 100],
+               latencies[ok - 1]);
+    }
+    printf("\n  odpowiedzi BUSY: %d (klientów: %d)  błędy połączenia: %d  inne błędy: %d\n", busy, busy_clients,
+           connect_failed, failed);
+    free(latencies);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_of_clients = DEFAULT_CLIENTS;
+    bool password_storm = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h:p:TR")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            num_of_clients = atoi(optarg);
+            break;
+        case 'h':
+            server_ip = optarg;
+            break;
+        case 'p':
+            server_port = atoi(optarg);
+            break;
+        case 'T':
+            // skip reconnecting with passwords (slow with many clients)
+            password_storm = false;
+            break;
+        case 'R':
+            // retry immediately after BUSY, like clients that ignore hints
+            follow_hints = false;
+            break;
+        default:
+            fprintf(stderr, "Użycie: %s [-n klienci] [-h adres] [-p port] [-T] [-R]\n"
+                            "  -T  bez ponownych połączeń z hasłem\n"
+                            "  -R  ignoruj podpowiedzi BUSY (ponów od razu)\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    bench_client *clients = calloc(num_of_clients, sizeof(bench_client));
+    if (!clients || num_of_clients <= 0)
+    {
+        fprintf(stderr, "Nieprawidłowa liczba klientów\n");
+        return 1;
+    }
+    for (int i = 0; i < num_of_clients; i++)
+    {
+        clients[i].id = i;
+        snprintf(clients[i].login, sizeof(clients[i].login), "bench%d", i);
+        snprintf(clients[i].password, sizeof(clients[i].password), "haslo%d", i);
+        clients[i].stale_socket = -1;
+    }
+
+    printf("Serwer %s:%d, klientów: %d\n", server_ip, server_port, num_of_clients);
+    srand(time(NULL));
+
+    // first phase creates accounts (or logs in if they already exist) a few at a time
+    run_phase("zakładanie kont", clients, num_of_clients, false, false, SETUP_CONCURRENCY);
+    // everybody reconnects at once, like after a network failure
+    if (password_storm)
+    {
+        run_phase("ponowne połączenia (hasło)", clients, num_of_clients, false, false, 0);
+    }
+    run_phase("ponowne połączenia (token)", clients, num_of_clients, true, false, 0);
+
+    // connections are dropped without logging out and everybody reconnects right away,
+    // server still sees the old sessions as logged in and has to take them over
+    run_phase("sesje bez wylogowania (token)", clients, num_of_clients, true, true, 0);
+    run_phase("ponowne połączenia po zerwaniu (token)", clients, num_of_clients, true, false, 0);
+    reset_stale_connections(clients, num_of_clients);
+
+    free(clients);
+    return 0;
+}
@@ -7,31 +7,92 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
 
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 7992
 #define BUFFER_SIZE 4096
+#define HEARTBEAT_INTERVAL 15 // seconds without sending anything before heartbeat is sent
+#define MAX_BUSY_RETRIES 10
+#define REPLAY_BUFFER_MAX (1024 * 1024) // data sent before login that can be sent again after BUSY
+#define SCRIPT_BUFFER_SIZE 65536 // script lines collected before they are sent at once
+#define MAX_PENDING_LINES (SCRIPT_BUFFER_SIZE / 2)
+#define FRAME_IDLE_MS 50         // incomplete frame (e.g. prompt without newline) is logged after this time
+#define DEFAULT_LINGER_MS 1000   // how long to wait for replies after the end of script
 
 // struct that keeps information about current connection
 typedef struct
 {
     int socket_fd;
-    bool running;
+    _Atomic bool running; // cleared by any thread when connection ends
 } connection_info;
 
 // global vars:
 connection_info conn = {-1, true};
 pthread_t receive_thread_id;
+pthread_t heartbeat_thread_id;
+pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER; // mutex for sending to the server
+_Atomic time_t last_send_time = 0; // read by heartbeat thread without send_mutex
+struct sockaddr_in server_addr;
+int busy_retries = 0; // used by main thread before receiving thread starts, then only by it
+
+// login state, server can refuse login with BUSY line after the prompts (when login data is sent),
+// then client reconnects and sends again everything that was sent before login
+_Atomic bool logged_in = false;
+char *replay_data = NULL; // data sent before login (guarded by send_mutex)
+size_t replay_length = 0;
+size_t replay_capacity = 0;
+bool replay_overflow = false;
+char login_reply[BUFFER_SIZE]; // data received before login (only receiving thread uses it)
+size_t login_reply_length = 0;
+
+// state of non-interactive mode (-s), events are written to stdout as JSON lines
+// fields used by both main and receiving thread are atomic
+typedef struct
+{
+    int input_fd;
+    int linger_ms;
+    _Atomic bool input_done;
+    _Atomic uint64_t done_time_us;
+    uint64_t start_time_us;
+    _Atomic long sent;
+    _Atomic long received;
+    _Atomic unsigned long long bytes_sent;
+    _Atomic unsigned long long bytes_received;
+    // lines waiting to be sent
+    char buffer[SCRIPT_BUFFER_SIZE];
+    size_t length;
+    size_t line_starts[MAX_PENDING_LINES];
+    int pending_lines;
+} script_info;
+
+bool script_mode = false;
+script_info script = {-1, DEFAULT_LINGER_MS};
+FILE *status_out; // human readable messages, stderr in script mode
 
 // funciton prototypes
 void *receive_messages(void *arg);
+void *receive_frames(void *arg);
+void run_script();
+void *send_heartbeats(void *arg);
+int send_data(const char *data, size_t len);
+int busy_retry_delay(int socket_fd);
+void track_login_reply(const char *data, size_t len);
+bool retry_login();
+uint64_t now_us();
+void log_event(const char *event, long seq, uint64_t ts, const char *data, size_t len);
 void handle_signal(int sig);
 void cleanup_resources();
 
 // handling signals ( killing the app)
 void handle_signal(int sig)
 {
-    printf("\nPrzerwanie działania klienta...\n");
+    // stdout has JSON events in script mode
+    fprintf(status_out, "\nPrzerwanie działania klienta...\n");
     conn.running = false;
     cleanup_resources();
     exit(0);
@@ -60,6 +121,11 @@ void *receive_messages(void *arg)
 
         if (bytes_received <= 0)
         {
+            // login refused with BUSY, connection is replaced
+            if (connection->running && retry_login())
+            {
+                continue;
+            }
             if (connection->running)
             {
                 printf("\nUtracono połączenie z serwerem.\n");
@@ -72,39 +138,558 @@ void *receive_messages(void *arg)
             // print recived message
             printf("%s", buffer);
             fflush(stdout);
+            track_login_reply(buffer, bytes_received);
         }
     }
 
     return NULL;
 }
 
+// send whole data, partial sends are continued (caller holds send_mutex)
+int send_all(int socket_fd, const char *data, size_t len)
+{
+    size_t sent = 0;
+    while (sent < len)
+    {
+        int result = send(socket_fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (result < 0)
+        {
+            return -1;
+        }
+        sent += result;
+    }
+    return 0;
+}
+
+// remember data sent before login, so it can be sent again after BUSY (caller holds send_mutex)
+// returns false when data doesn't fit
+bool record_replay(const char *data, size_t len)
+{
+    if (replay_overflow || replay_length + len > REPLAY_BUFFER_MAX)
+    {
+        replay_overflow = true;
+        return false;
+    }
+    if (replay_length + len > replay_capacity)
+    {
+        size_t capacity = replay_capacity ? replay_capacity : BUFFER_SIZE;
+        while (capacity < replay_length + len)
+        {
+            capacity *= 2;
+        }
+        char *new_data = realloc(replay_data, capacity);
+        if (!new_data)
+        {
+            replay_overflow = true;
+            return false;
+        }
+        replay_data = new_data;
+        replay_capacity = capacity;
+    }
+    memcpy(replay_data + replay_length, data, len);
+    replay_length += len;
+    return true;
+}
+
+// send data to the server (used by main loop, script and heartbeat thread)
+// partial sends are continued, so big script batches are sent whole
+int send_data(const char *data, size_t len)
+{
+    pthread_mutex_lock(&send_mutex);
+    bool recorded = !logged_in && record_replay(data, len);
+    // data sent before login is sent again if server refuses login, so failed send isn't final
+    if (send_all(conn.socket_fd, data, len) < 0 && !recorded)
+    {
+        pthread_mutex_unlock(&send_mutex);
+        return -1;
+    }
+    last_send_time = time(NULL);
+    pthread_mutex_unlock(&send_mutex);
+    return len;
+}
+
+// thread that sends heartbeat (empty line) when nothing was sent for a while,
+// so the server knows that connection is still alive
+void *send_heartbeats(void *arg)
+{
+    connection_info *connection = (connection_info *)arg;
+
+    while (connection->running)
+    {
+        sleep(1);
+        if (connection->running && time(NULL) - last_send_time >= HEARTBEAT_INTERVAL)
+        {
+            send_data("\n", 1);
+        }
+    }
+
+    return NULL;
+}
+
+// check if server refused connection with "BUSY <retry_after_ms> <jitter_ms> ..."
+// returns delay before next attempt (with random jitter) or -1 if server isn't busy
+// the message is only peeked, so login prompt stays for the receiving thread
+int busy_retry_delay(int socket_fd)
+{
+    char buffer[128];
+    for (int i = 0; i < 100; i++)
+    {
+        int bytes_received = recv(socket_fd, buffer, sizeof(buffer) - 1, MSG_PEEK);
+        if (bytes_received <= 0)
+        {
+            return -1;
+        }
+        buffer[bytes_received] = '\0';
+
+        // not a busy message
+        size_t compared = bytes_received < 5 ? bytes_received : 5;
+        if (strncmp(buffer, "BUSY ", compared) != 0)
+        {
+            return -1;
+        }
+
+        unsigned int retry_ms, jitter_ms;
+        if (strchr(buffer, '\n') && sscanf(buffer, "BUSY %u %u", &retry_ms, &jitter_ms) == 2)
+        {
+            return retry_ms + (jitter_ms > 0 ? rand() % (jitter_ms + 1) : 0);
+        }
+
+        // wait for the rest of the message
+        usleep(10 * 1000);
+    }
+    return -1;
+}
+
+// find complete "BUSY <retry_after_ms> <jitter_ms> ..." line anywhere in text
+// (after login data it comes after the prompts, which don't end with newline)
+// returns delay before next attempt (with random jitter) or -1 if there is no such line
+int busy_line_delay(const char *text)
+{
+    for (const char *line = text; line; line = strchr(line, '\n'))
+    {
+        if (*line == '\n')
+        {
+            line++;
+        }
+        unsigned int retry_ms, jitter_ms;
+        if (strncmp(line, "BUSY ", 5) == 0 && strchr(line, '\n') &&
+            sscanf(line, "BUSY %u %u", &retry_ms, &jitter_ms) == 2)
+        {
+            return retry_ms + (jitter_ms > 0 ? rand() % (jitter_ms + 1) : 0);
+        }
+    }
+    return -1;
+}
+
+// keep data received before login, so BUSY line can be found when connection ends
+// server's welcome message means that login succeeded and nothing has to be sent again
+void track_login_reply(const char *data, size_t len)
+{
+    if (logged_in)
+    {
+        return;
+    }
+    if (len > sizeof(login_reply) - 1 - login_reply_length)
+    {
+        // only the end matters, BUSY is the last thing server sends
+        login_reply_length = 0;
+        if (len > sizeof(login_reply) - 1)
+        {
+            data += len - (sizeof(login_reply) - 1);
+            len = sizeof(login_reply) - 1;
+        }
+    }
+    memcpy(login_reply + login_reply_length, data, len);
+    login_reply_length += len;
+    login_reply[login_reply_length] = '\0';
+
+    if (strstr(login_reply, "Pomyślnie zalogowano"))
+    {
+        pthread_mutex_lock(&send_mutex);
+        logged_in = true;
+        free(replay_data);
+        replay_data = NULL;
+        replay_length = replay_capacity = 0;
+        pthread_mutex_unlock(&send_mutex);
+    }
+}
+
+// create socket and connect to the server, returns socket or -1
+int connect_server()
+{
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd < 0)
+    {
+        perror("Błąd tworzenia gniazda");
+        return -1;
+    }
+
+    char server_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &server_addr.sin_addr, server_ip, sizeof(server_ip));
+    fprintf(status_out, "Łączenie z serwerem %s:%d...\n", server_ip, ntohs(server_addr.sin_port));
+    if (connect(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("Błąd podczas łączenia z serwerem");
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+// called by receiving thread when connection ends before login
+// if server refused login with BUSY, waits and connects again, then sends again
+// everything that was sent before login; returns true when connection was replaced
+bool retry_login()
+{
+    int retry_ms = logged_in ? -1 : busy_line_delay(login_reply);
+    if (retry_ms < 0)
+    {
+        return false;
+    }
+    login_reply_length = 0;
+    login_reply[0] = '\0';
+
+    if (++busy_retries >= MAX_BUSY_RETRIES || replay_overflow)
+    {
+        fprintf(status_out, "Serwer jest zajęty. Spróbuj później.\n");
+        return false;
+    }
+    fprintf(status_out, "Serwer jest zajęty, ponowna próba za %d ms...\n", retry_ms);
+    usleep(retry_ms * 1000);
+
+    int socket_fd = connect_server();
+    if (socket_fd < 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&send_mutex);
+    close(conn.socket_fd);
+    conn.socket_fd = socket_fd;
+    bool sent = send_all(socket_fd, replay_data, replay_length) == 0;
+    pthread_mutex_unlock(&send_mutex);
+
+    if (script_mode)
+    {
+        log_event("reconnect", -1, now_us(), NULL, 0);
+    }
+    return sent;
+}
+
+// current wall clock time in microseconds (timestamps of logged events)
+uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// write one event as JSON line: {"ts":..,"ev":"..","seq":..,"data":".."}
+// data is escaped, seq and data are skipped when seq < 0
+void log_event(const char *event, long seq, uint64_t ts, const char *data, size_t len)
+{
+    char *line = malloc(len * 6 + 128);
+    if (!line)
+    {
+        return;
+    }
+    int length = sprintf(line, "{\"ts\":%llu,\"ev\":\"%s\"", (unsigned long long)ts, event);
+    if (seq >= 0)
+    {
+        length += sprintf(line + length, ",\"seq\":%ld,\"data\":\"", seq);
+        for (size_t i = 0; i < len; i++)
+        {
+            unsigned char c = data[i];
+            if (c == '"' || c == '\\')
+            {
+                line[length++] = '\\';
+                line[length++] = c;
+            }
+            else if (c == '\n')
+            {
+                length += sprintf(line + length, "\\n");
+            }
+            else if (c == '\t')
+            {
+                length += sprintf(line + length, "\\t");
+            }
+            else if (c < 0x20 || c == 0x7f)
+            {
+                length += sprintf(line + length, "\\u%04x", c);
+            }
+            else
+            {
+                line[length++] = c;
+            }
+        }
+        line[length++] = '"';
+    }
+    line[length++] = '}';
+    line[length++] = '\n';
+
+    // one write per event, so lines of both threads don't mix
+    fwrite(line, 1, length, stdout);
+    free(line);
+}
+
+// thread that recives data in script mode and splits it into frames (lines)
+// every frame is logged with its own timestamp, incomplete frame is kept for next recv,
+// it is logged alone only when nothing more arrives (prompts don't end with newline)
+void *receive_frames(void *arg)
+{
+    connection_info *connection = (connection_info *)arg;
+    char buffer[BUFFER_SIZE * 2];
+    size_t length = 0;
+    uint64_t last_data_us = now_us();
+
+    while (connection->running)
+    {
+        struct pollfd poll_fd = {connection->socket_fd, POLLIN, 0};
+        int ready = poll(&poll_fd, 1, length > 0 ? FRAME_IDLE_MS : 100);
+        if (ready < 0)
+        {
+            continue;
+        }
+
+        if (ready == 0)
+        {
+            if (length > 0)
+            {
+                log_event("recv", ++script.received, now_us(), buffer, length);
+                length = 0;
+            }
+
+            // script ended and server is quiet (done_time_us is set before input_done)
+            if (script.input_done)
+            {
+                uint64_t done_time_us = script.done_time_us;
+                uint64_t last_activity = last_data_us > done_time_us ? last_data_us : done_time_us;
+                if (now_us() - last_activity >= (uint64_t)script.linger_ms * 1000)
+                {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        int bytes_received = recv(connection->socket_fd, buffer + length, sizeof(buffer) - length, 0);
+        uint64_t ts = now_us();
+        if (bytes_received <= 0)
+        {
+            if (length > 0)
+            {
+                log_event("recv", ++script.received, ts, buffer, length);
+                length = 0;
+            }
+            log_event("close", -1, ts, NULL, 0);
+            // login refused with BUSY, connection is replaced
+            if (retry_login())
+            {
+                last_data_us = now_us();
+                continue;
+            }
+            break;
+        }
+        track_login_reply(buffer + length, bytes_received);
+        last_data_us = ts;
+        script.bytes_received += bytes_received;
+        length += bytes_received;
+
+        // log every complete frame
+        char *start = buffer;
+        char *newline;
+        while ((newline = memchr(start, '\n', buffer + length - start)) != NULL)
+        {
+            log_event("recv", ++script.received, ts, start, newline - start);
+            start = newline + 1;
+        }
+        length -= start - buffer;
+        memmove(buffer, start, length);
+
+        // too long frame, log what we have
+        if (length == sizeof(buffer))
+        {
+            log_event("recv", ++script.received, ts, buffer, length);
+            length = 0;
+        }
+    }
+
+    connection->running = false;
+    return NULL;
+}
+
+// send all collected script lines with one send and log them
+// returns false when connection is broken
+bool flush_script()
+{
+    if (script.length == 0)
+    {
+        return true;
+    }
+
+    uint64_t ts = now_us();
+    if (send_data(script.buffer, script.length) < 0)
+    {
+        return false;
+    }
+    script.bytes_sent += script.length;
+
+    for (int i = 0; i < script.pending_lines; i++)
+    {
+        size_t start = script.line_starts[i];
+        size_t end = i + 1 < script.pending_lines ? script.line_starts[i + 1] : script.length;
+        log_event("send", ++script.sent, ts, script.buffer + start, end - start - 1);
+    }
+    script.length = 0;
+    script.pending_lines = 0;
+    return true;
+}
+
+// handle one line of the script:
+// "# ..." is a comment, "@sleep <ms>" sends collected lines and waits,
+// anything else is sent to the server as it is (without waiting for reply)
+bool handle_script_line(char *line, size_t len)
+{
+    if (len > 0 && line[len - 1] == '\r')
+    {
+        len--;
+    }
+    if (len == 0 || line[0] == '#')
+    {
+        return true;
+    }
+
+    if (len > 7 && strncmp(line, "@sleep ", 7) == 0)
+    {
+        line[len] = '\0';
+        if (!flush_script())
+        {
+            return false;
+        }
+        usleep(atoi(line + 7) * 1000);
+        return true;
+    }
+
+    if (script.length + len + 1 > SCRIPT_BUFFER_SIZE || script.pending_lines == MAX_PENDING_LINES)
+    {
+        if (!flush_script())
+        {
+            return false;
+        }
+    }
+
+    script.line_starts[script.pending_lines++] = script.length;
+    memcpy(script.buffer + script.length, line, len);
+    script.length += len;
+    script.buffer[script.length++] = '\n';
+    return true;
+}
+
+// non-interactive mode: read script (file or stdin) and send it in batches
+// lines are collected until input has nothing more to give right now
+// or the buffer is full, so many messages are in flight at once
+void run_script()
+{
+    char input[BUFFER_SIZE];
+    size_t length = 0;
+    bool input_open = true;
+
+    while (conn.running && (input_open || length > 0))
+    {
+        char *newline = memchr(input, '\n', length);
+        if (newline == NULL && input_open && length < BUFFER_SIZE - 1)
+        {
+            // read would block (e.g. stdin stream), send what we have first
+            struct pollfd poll_fd = {script.input_fd, POLLIN, 0};
+            if (poll(&poll_fd, 1, 0) == 0 && !flush_script())
+            {
+                break;
+            }
+
+            int bytes_read = read(script.input_fd, input + length, BUFFER_SIZE - 1 - length);
+            if (bytes_read <= 0)
+            {
+                input_open = false;
+            }
+            else
+            {
+                length += bytes_read;
+            }
+            continue;
+        }
+
+        // line without newline at the end of input or too long line
+        size_t line_length = newline ? (size_t)(newline - input) : length;
+        if (!handle_script_line(input, line_length))
+        {
+            break;
+        }
+        size_t consumed = newline ? line_length + 1 : line_length;
+        length -= consumed;
+        memmove(input, input + consumed, length);
+    }
+
+    if (conn.running && !flush_script())
+    {
+        fprintf(status_out, "Błąd wysyłania danych\n");
+    }
+}
+
 int main(int argc, char *argv[])
 {
     char *server_ip = SERVER_IP;
     int server_port = SERVER_PORT;
+    status_out = stdout;
 
-    if (argc >= 2)
+    int option;
+    while ((option = getopt(argc, argv, "s:w:")) != -1)
     {
-        server_ip = argv[1];
+        switch (option)
+        {
+        case 's':
+            // script file, "-" means stdin
+            script_mode = true;
+            if (strcmp(optarg, "-") == 0)
+            {
+                script.input_fd = STDIN_FILENO;
+            }
+            else if ((script.input_fd = open(optarg, O_RDONLY)) < 0)
+            {
+                perror("Nie można otworzyć skryptu");
+                return 1;
+            }
+            break;
+        case 'w':
+            script.linger_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Użycie: %s [-s skrypt|-] [-w ms] [adres] [port]\n"
+                            "  -s  tryb nieinteraktywny: wysyła linie skryptu, zdarzenia wypisuje jako JSON\n"
+                            "  -w  czas oczekiwania na odpowiedzi po końcu skryptu (domyślnie %d ms)\n",
+                    argv[0], DEFAULT_LINGER_MS);
+            return 1;
+        }
     }
 
-    if (argc >= 3)
+    if (optind < argc)
     {
-        server_port = atoi(argv[2]);
+        server_ip = argv[optind];
     }
 
-    signal(SIGINT, handle_signal);
+    if (optind + 1 < argc)
+    {
+        server_port = atoi(argv[optind + 1]);
+    }
 
-    // create socket
-    conn.socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (conn.socket_fd < 0)
+    // stdout is for events in script mode
+    if (script_mode)
     {
-        perror("Błąd tworzenia gniazda");
-        return 1;
+        status_out = stderr;
     }
 
+    signal(SIGINT, handle_signal);
+
     // config addr
-    struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(server_port);
@@ -112,29 +697,81 @@ int main(int argc, char *argv[])
     if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0)
     {
         perror("Nieprawidłowy adres IP serwera");
-        cleanup_resources();
         return 1;
     }
 
-    // connect to the server
-    printf("Łączenie z serwerem %s:%d...\n", server_ip, server_port);
-    if (connect(conn.socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    srand(time(NULL) ^ getpid());
+
+    // connect to the server, busy server tells when to try again
+    for (;;)
     {
-        perror("Błąd podczas łączenia z serwerem");
+        conn.socket_fd = connect_server();
+        if (conn.socket_fd < 0)
+        {
+            return 1;
+        }
+
+        int retry_ms = busy_retry_delay(conn.socket_fd);
+        if (retry_ms < 0)
+        {
+            break;
+        }
+
         cleanup_resources();
-        return 1;
+        if (++busy_retries >= MAX_BUSY_RETRIES)
+        {
+            fprintf(status_out, "Serwer jest zajęty. Spróbuj później.\n");
+            return 1;
+        }
+        fprintf(status_out, "Serwer jest zajęty, ponowna próba za %d ms...\n", retry_ms);
+        usleep(retry_ms * 1000);
     }
 
-    printf("Połączono z serwerem!\n");
+    fprintf(status_out, "Połączono z serwerem!\n");
+    if (script_mode)
+    {
+        script.start_time_us = now_us();
+        log_event("connect", -1, script.start_time_us, NULL, 0);
+    }
 
     // create reciving thread
-    if (pthread_create(&receive_thread_id, NULL, receive_messages, &conn) != 0)
+    if (pthread_create(&receive_thread_id, NULL, script_mode ? receive_frames : receive_messages, &conn) != 0)
     {
         perror("Nie można utworzyć wątku odbierającego");
         cleanup_resources();
         return 1;
     }
 
+    // create heartbeat thread
+    last_send_time = time(NULL);
+    if (pthread_create(&heartbeat_thread_id, NULL, send_heartbeats, &conn) != 0)
+    {
+        perror("Nie można utworzyć wątku heartbeat");
+        cleanup_resources();
+        return 1;
+    }
+    pthread_detach(heartbeat_thread_id);
+
+    if (script_mode)
+    {
+        run_script();
+        script.done_time_us = now_us();
+        script.input_done = true;
+
+        // wait for replies, receiving thread ends when server is quiet or closes connection
+        pthread_join(receive_thread_id, NULL);
+        conn.running = false;
+
+        uint64_t end_time_us = now_us();
+        printf("{\"ts\":%llu,\"ev\":\"summary\",\"sent\":%ld,\"received\":%ld,"
+               "\"bytes_sent\":%llu,\"bytes_received\":%llu,\"elapsed_ms\":%.3f}\n",
+               (unsigned long long)end_time_us, script.sent, script.received, script.bytes_sent,
+               script.bytes_received, (end_time_us - script.start_time_us) / 1000.0);
+        fflush(stdout);
+        cleanup_resources();
+        return 0;
+    }
+
     char input[BUFFER_SIZE];
 
     // main client loop
@@ -147,7 +784,7 @@ int main(int argc, char *argv[])
         }
 
         // send message to server
-        if (send(conn.socket_fd, input, strlen(input), 0) < 0)
+        if (send_data(input, strlen(input)) < 0)
         {
             perror("Błąd wysyłania danych");
             break;
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // accept4
 #include <netinet/in.h>
 #include <stdio.h>
 #include <arpa/inet.h>
@@ -7,18 +8,73 @@
 #include <pthread.h>
 #include <sys/queue.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <errno.h>
 
 #define PORT 7992
-#define MAX_CLIENTS 20
+#define MAX_CLIENTS 20 // default, can be changed with -m
 #define BUFFER_SIZE 4096
 #define LOGIN_SIZE 256
 
+// connection timeouts
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+#define LOGIN_TIMEOUT_MS 15000
+#define IDLE_TIMEOUT_MS 45000 // clients send heartbeat (empty line) every 15 s
+#define WRITE_TIMEOUT_MS 5000
+#define TAKEOVER_TIMEOUT_MS 5000 // waiting for the old session to end when owner logs in again
+#define CLOSE_LINGER_MS 200       // refused connection is closed after this time, not right after reply
+
+// message history settings
+#define HISTORY_DATA_FILE "history.dat"
+#define HISTORY_INDEX_FILE "history.idx"
+#define HISTORY_INDEX_CHUNK 65536 // index file grows by this many entries at once
+#define HISTORY_PAGE_SIZE 20
+#define HISTORY_MAX_RESULTS 100
+#define HISTORY_SEARCH true // keep inverted index for keyword search
+#define HISTORY_SCAN_CHUNK (1 << 20) // data file is read in chunks of this size when indexes are rebuilt
+#define HISTORY_MAGIC 0x3130594853494d48ULL
+#define HISTORY_NONE UINT64_MAX
+
+// accounts
+#define CREDENTIALS_FILE "users.db"
+#define SCRYPT_N 16384 // memory used by one hash: 128 * r * N bytes (16 MB)
+#define SCRYPT_R 8
+#define SCRYPT_P 1
+#define SALT_SIZE 16
+#define HASH_SIZE 32
+#define TOKEN_SIZE 32
+#define TOKEN_TTL_MS (24 * 3600 * 1000ULL)
+#define HASH_WORKERS 4
+#define HASH_QUEUE_SIZE 64 // logins waiting for hashing, more are refused
+
+// accepting connections (defaults, can be changed with command line options)
+#define LISTEN_BACKLOG 4096       // limited by the system (somaxconn)
+#define HANDSHAKE_WAIT_MAX 4096   // connections waiting for login data (until login timeout)
+#define HANDSHAKE_QUEUE_SIZE 1024 // connections with login data waiting for a handshake worker
+#define HANDSHAKE_WORKERS 32      // connections being logged in at the same time
+#define ACCEPT_BATCH 256          // connections accepted at once before checking other events
+#define RETRY_MIN_MS 100          // bounds of retry hint sent to refused clients
+#define RETRY_MAX_MS 30000
+
 // queue message struct
 struct entry
 {
   char *from_login;
   char *to_login;
   char *message;
+  // time when the message was accepted by the server (ms since epoch)
+  uint64_t timestamp;
   // STAILQ - single tail queue (with pointer to tail)
   STAILQ_ENTRY(entry)
   entries;
@@ -27,6 +83,36 @@ struct entry
 // definition of queue head
 STAILQ_HEAD(stailhead, entry);
 
+// kind of connection timer (for logging what has expired)
+enum timer_kind
+{
+  TIMER_LOGIN,
+  TIMER_IDLE,
+  TIMER_LINGER // socket of refused connection waiting to be closed, timer is freed when it fires
+};
+
+// connection timer kept in the timer wheel, when it expires the socket is shut down
+// so the thread blocked on it wakes up with an error
+struct timer
+{
+  LIST_ENTRY(timer)
+  entries;
+  uint64_t expires; // tick of the wheel
+  int socket;
+  enum timer_kind kind;
+  bool armed;
+};
+
+// definition of timer list head (one slot of the wheel)
+LIST_HEAD(timer_list, timer);
+
+// buffer for splitting data received from socket into lines
+struct line_reader
+{
+  char buffer[BUFFER_SIZE];
+  size_t length;
+};
+
 // client struct (that is kept in a arr)
 struct client
 {
@@ -36,22 +122,263 @@ struct client
   // every client has it's own message queue - for delivering message later after
   // they logged out
   struct stailhead queue;
+  // login timeout, later idle timeout of the connection
+  struct timer timer;
+  // data received but not yet parsed into commands
+  struct line_reader reader;
+};
+
+// stage of connection that is logging in
+enum handshake_stage
+{
+  HANDSHAKE_LOGIN,   // waiting for login or "t <login> <token>"
+  HANDSHAKE_PASSWORD // waiting for password
+};
+
+// connection that is logging in
+struct pending_connection
+{
+  // socket, login timer, login and data received so far
+  struct client *client;
+  enum handshake_stage stage;
+  // password or token line, set when the connection is ready for a worker
+  char *secret;
+  uint64_t accepted_at;
 };
 
 // array of clients
-struct client *client_list[MAX_CLIENTS];
+struct client **client_list = NULL;
 int num_of_clients = 0;
 
+// server settings
+int port = PORT;
+int max_clients = MAX_CLIENTS;
+int listen_backlog = LISTEN_BACKLOG;
+int handshake_queue_size = HANDSHAKE_QUEUE_SIZE;
+int handshake_workers = HANDSHAKE_WORKERS;
+
 // global message queue for all messages
 struct stailhead message_queue;
 
+// places in client list reserved for logins that are being authenticated
+int reserved_clients = 0;
+
 pthread_mutex_t mutex_cl = PTHREAD_MUTEX_INITIALIZER; // mutex for client list
+pthread_cond_t cond_cl = PTHREAD_COND_INITIALIZER;    // condition for client logout
 pthread_mutex_t mutex_mq = PTHREAD_MUTEX_INITIALIZER; // mutex for message queue
 pthread_cond_t cond_mq = PTHREAD_COND_INITIALIZER;    // condition for message queue
 
 // flag that indicates if server is still running
 volatile bool server_running = true;
 
+void cleanup();
+void busyMessage(char *out, size_t size, uint64_t min_retry_ms);
+
+// ---------------------------------------------------------------------------
+// Timer wheel
+//
+// Hierarchical timer wheel for connection timeouts (login, idle).
+// Level 0 has one slot per tick, every next level has slots TIMER_WHEEL_SLOTS
+// times longer. Arming and cancelling is O(1); timers from higher levels are
+// moved down when the lower level wraps. One thread advances the wheel.
+// ---------------------------------------------------------------------------
+
+struct timer_list timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+uint64_t timer_wheel_now = 0; // current tick
+
+pthread_mutex_t mutex_tw = PTHREAD_MUTEX_INITIALIZER; // mutex for timer wheel
+
+// Function that puts timer into the right slot (mutex_tw must be held)
+void timerPlace(struct timer *timer)
+{
+  uint64_t delta = timer->expires > timer_wheel_now ? timer->expires - timer_wheel_now : 0;
+  uint64_t max_delta = (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+  if (delta > max_delta)
+  {
+    delta = max_delta;
+    timer->expires = timer_wheel_now + delta;
+  }
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+  {
+    level++;
+  }
+
+  // already expired timers (while moving down) go to the slot that is processed now
+  uint64_t tick = delta == 0 ? timer_wheel_now : timer->expires;
+  int slot = (tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+  LIST_INSERT_HEAD(&timer_wheel[level][slot], timer, entries);
+}
+
+// Function that (re)arms timer to expire after timeout_ms
+void timerArm(struct timer *timer, int socket, enum timer_kind kind, uint64_t timeout_ms)
+{
+  pthread_mutex_lock(&mutex_tw);
+  if (timer->armed)
+  {
+    LIST_REMOVE(timer, entries);
+  }
+  uint64_t ticks = (timeout_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  timer->expires = timer_wheel_now + (ticks > 0 ? ticks : 1);
+  timer->socket = socket;
+  timer->kind = kind;
+  timer->armed = true;
+  timerPlace(timer);
+  pthread_mutex_unlock(&mutex_tw);
+}
+
+// Function that cancels timer, after it returns the timer won't fire
+void timerCancel(struct timer *timer)
+{
+  pthread_mutex_lock(&mutex_tw);
+  if (timer->armed)
+  {
+    LIST_REMOVE(timer, entries);
+    timer->armed = false;
+  }
+  pthread_mutex_unlock(&mutex_tw);
+}
+
+// Function that reads and drops data that client has already sent
+void drainSocket(int socket)
+{
+  char buffer[BUFFER_SIZE];
+  while (recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+    ;
+}
+
+// Function that closes connection after the last reply without reset. close() with unread
+// data sends RST, and then client can lose the reply before reading it. Sending side is shut
+// down now (client gets FIN after the reply), data that client sends meanwhile is dropped and
+// the socket is closed by timer thread after CLOSE_LINGER_MS, so no thread waits for it
+void closeGracefully(int socket)
+{
+  shutdown(socket, SHUT_WR);
+  drainSocket(socket);
+
+  struct timer *timer = malloc(sizeof(struct timer));
+  if (!timer)
+  {
+    close(socket);
+    return;
+  }
+  timer->armed = false;
+  timerArm(timer, socket, TIMER_LINGER, CLOSE_LINGER_MS);
+}
+
+// Function that moves the wheel by one tick and fires expired timers (mutex_tw must be held)
+void timerAdvance()
+{
+  timer_wheel_now++;
+
+  // when lower level wraps, move timers from the current slot of the higher level down
+  for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+  {
+    if ((timer_wheel_now & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) != 0)
+      break;
+
+    int slot = (timer_wheel_now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    struct timer_list moved = LIST_HEAD_INITIALIZER(moved);
+    while (!LIST_EMPTY(&timer_wheel[level][slot]))
+    {
+      struct timer *timer = LIST_FIRST(&timer_wheel[level][slot]);
+      LIST_REMOVE(timer, entries);
+      LIST_INSERT_HEAD(&moved, timer, entries);
+    }
+    while (!LIST_EMPTY(&moved))
+    {
+      struct timer *timer = LIST_FIRST(&moved);
+      LIST_REMOVE(timer, entries);
+      timerPlace(timer);
+    }
+  }
+
+  struct timer_list *expired = &timer_wheel[0][timer_wheel_now & (TIMER_WHEEL_SLOTS - 1)];
+  while (!LIST_EMPTY(expired))
+  {
+    struct timer *timer = LIST_FIRST(expired);
+    LIST_REMOVE(timer, entries);
+    timer->armed = false;
+
+    if (timer->kind == TIMER_LINGER)
+    {
+      drainSocket(timer->socket);
+      close(timer->socket);
+      free(timer);
+      continue;
+    }
+
+    const char *reason = timer->kind == TIMER_LOGIN ? "logowania" : "bezczynności";
+    printf("Przekroczono czas %s, zamykanie połączenia (socket %d)\n", reason, timer->socket);
+    // wakes up the thread blocked in recv/send on this socket
+    shutdown(timer->socket, SHUT_RDWR);
+  }
+}
+
+// thread that advances the timer wheel
+void *timerWheelThread(void *args)
+{
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (server_running)
+  {
+    usleep(TIMER_TICK_MS * 1000);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+    // catch up if the thread was sleeping longer than one tick
+    pthread_mutex_lock(&mutex_tw);
+    while (timer_wheel_now < elapsed_ms / TIMER_TICK_MS)
+    {
+      timerAdvance();
+    }
+    pthread_mutex_unlock(&mutex_tw);
+  }
+  return NULL;
+}
+
+// Function that takes one complete line (without newline) from the reader into `line`
+// returns length of the line or -1 when there is no complete line yet
+// lines longer than the buffer are split
+int takeLine(struct line_reader *reader, char *line, size_t size)
+{
+  char *newline = memchr(reader->buffer, '\n', reader->length);
+  if (!newline && reader->length < BUFFER_SIZE - 1)
+    return -1;
+
+  size_t line_len = newline ? (size_t)(newline - reader->buffer) : reader->length;
+  size_t consumed = newline ? line_len + 1 : line_len;
+  if (line_len > 0 && reader->buffer[line_len - 1] == '\r')
+    line_len--;
+  if (line_len >= size)
+    line_len = size - 1;
+
+  memcpy(line, reader->buffer, line_len);
+  line[line_len] = '\0';
+  reader->length -= consumed;
+  memmove(reader->buffer, reader->buffer + consumed, reader->length);
+  return line_len;
+}
+
+// Function that reads one line from socket (without newline) into `line`
+// returns length of the line or -1 when client disconnected
+int readLine(int socket, struct line_reader *reader, char *line, size_t size)
+{
+  while (true)
+  {
+    int line_len = takeLine(reader, line, size);
+    if (line_len >= 0)
+      return line_len;
+
+    int bytes_read = recv(socket, reader->buffer + reader->length, BUFFER_SIZE - 1 - reader->length, 0);
+    if (bytes_read <= 0)
+      return -1;
+    reader->length += bytes_read;
+  }
+}
+
 // Function for handling kill signals
 void handle_signal(int sig)
 {
@@ -89,6 +416,7 @@ void removeClient(struct client *client)
   }
 
   // close socket, free memory
+  timerCancel(&client->timer);
   close(client->socket);
   free(client);
 
@@ -113,24 +441,51 @@ void logoutClient(struct client *client)
   {
     client_list[index]->is_logged_in = false;
     printf("Klient '%s' został rozłączony.\n", client->login);
+    // new session of this account may wait for the old one to end
+    pthread_cond_broadcast(&cond_cl);
   }
+  timerCancel(&client->timer);
+  // wakes up delivery thread if it is sending to this socket, before the number can be reused
+  shutdown(client->socket, SHUT_RDWR);
   close(client->socket);
   pthread_mutex_unlock(&mutex_cl);
 }
 
-// Function that finds a client with given login, returns the pointer to that client
-struct client *findClientByLogin(const char *login)
+// Function that returns current wall clock time in milliseconds
+uint64_t currentTimeMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Function that frees a queue entry with all its fields
+void freeEntry(struct entry *entry)
+{
+  free(entry->from_login);
+  free(entry->to_login);
+  free(entry->message);
+  free(entry);
+}
+
+// Function that finds a client with given login (mutex_cl must be held)
+struct client *findClientByLoginLocked(const char *login)
 {
-  pthread_mutex_lock(&mutex_cl);
-  struct client *found = NULL;
   for (int i = 0; i < num_of_clients; i++)
   {
     if (strcmp(client_list[i]->login, login) == 0)
     {
-      found = client_list[i];
-      break;
+      return client_list[i];
     }
   }
+  return NULL;
+}
+
+// Function that finds a client with given login, returns the pointer to that client
+struct client *findClientByLogin(const char *login)
+{
+  pthread_mutex_lock(&mutex_cl);
+  struct client *found = findClientByLoginLocked(login);
   pthread_mutex_unlock(&mutex_cl);
   return found;
 }
@@ -153,14 +508,21 @@ void addMessageToQueue(const char *from_login, const char *to_login, const char
   new_entry->from_login = strdup(from_login);
   new_entry->to_login = strdup(to_login);
   new_entry->message = strdup(message);
+  new_entry->timestamp = currentTimeMs();
 
-  struct client *client_to = findClientByLogin(to_login);
+  pthread_mutex_lock(&mutex_cl);
+  struct client *client_to = findClientByLoginLocked(to_login);
   // if client isn't logged in right now, add the message to personal queue to be sent later
+  // (personal queues are changed under mutex_mq, like in deliverPastMessages)
   if (!client_to->is_logged_in)
   {
+    pthread_mutex_lock(&mutex_mq);
     STAILQ_INSERT_TAIL(&client_to->queue, new_entry, entries);
+    pthread_mutex_unlock(&mutex_mq);
+    pthread_mutex_unlock(&mutex_cl);
     return;
   }
+  pthread_mutex_unlock(&mutex_cl);
 
   // else if client is logged currently, add the new message to the global messege queue
   pthread_mutex_lock(&mutex_mq);
@@ -169,118 +531,1587 @@ void addMessageToQueue(const char *from_login, const char *to_login, const char
   pthread_mutex_unlock(&mutex_mq);
 }
 
-// Function that delivers messages that are waiting in the personal queues
-void deliverPastMessages(struct client *client)
+// Function that delivers messages that are waiting in the personal queues
+void deliverPastMessages(struct client *client)
+{
+  // move whole personal queue to the global queue (to be sent), keeping original timestamps
+  pthread_mutex_lock(&mutex_mq);
+  if (!STAILQ_EMPTY(&client->queue))
+  {
+    STAILQ_CONCAT(&message_queue, &client->queue);
+    pthread_cond_signal(&cond_mq);
+  }
+  pthread_mutex_unlock(&mutex_mq);
+}
+
+// ---------------------------------------------------------------------------
+// Message history
+//
+// Delivered messages are appended to HISTORY_DATA_FILE by a separate writer
+// thread, so the delivery thread only pushes the entry on a queue. Every
+// record gets a fixed size entry in HISTORY_INDEX_FILE, which is mmapped.
+// Entries of one conversation (pair of users) are chained through `prev`, so
+// the last messages of a conversation are found without scanning the file.
+// Words are indexed separately for the sender and the recipient, so a search
+// reads only messages of the user who searches.
+// ---------------------------------------------------------------------------
+
+// record header in the data file, followed by from, to and message bytes
+struct history_record
+{
+  uint64_t timestamp;
+  uint32_t from_len;
+  uint32_t to_len;
+  uint32_t message_len;
+  uint32_t reserved;
+};
+
+// entry in the index file, entries of the same conversation are chained
+struct history_index_entry
+{
+  uint64_t pair_key;
+  uint64_t timestamp;
+  uint64_t offset; // offset of the record in the data file
+  uint64_t prev;   // previous entry of the same conversation or HISTORY_NONE
+};
+
+// header of the index file (takes the place of the first entry)
+struct history_index_header
+{
+  uint64_t magic;
+  uint64_t count;     // number of committed entries
+  uint64_t data_size; // committed size of the data file
+  uint64_t reserved;
+};
+
+// newest entry of a conversation (open addressing hash table)
+struct history_pair
+{
+  uint64_t key;
+  uint64_t last;
+};
+
+// inverted index: list of entries of one user that contain a word
+struct history_posting
+{
+  uint64_t word;
+  uint64_t *ids;
+  uint32_t count;
+  uint32_t capacity;
+};
+
+// message read back from the data file
+struct history_message
+{
+  uint64_t timestamp;
+  char from_login[LOGIN_SIZE];
+  char to_login[LOGIN_SIZE];
+  char message[BUFFER_SIZE];
+};
+
+struct history_store
+{
+  bool enabled;
+  int data_fd;
+  int index_fd;
+  struct history_index_header *header; // mmapped index file
+  struct history_index_entry *index;   // entries right after the header
+  uint64_t capacity;                   // number of entries the mapping can hold
+  struct history_pair *pairs;
+  uint64_t pairs_capacity;
+  uint64_t pairs_count;
+  struct history_posting *words;
+  uint64_t words_capacity;
+  uint64_t words_count;
+  pthread_t writer;
+};
+
+struct history_store history = {false, -1, -1};
+
+// queue of delivered messages waiting to be written
+struct stailhead history_queue = STAILQ_HEAD_INITIALIZER(history_queue);
+
+pthread_mutex_t mutex_hq = PTHREAD_MUTEX_INITIALIZER;     // mutex for history queue
+pthread_cond_t cond_hq = PTHREAD_COND_INITIALIZER;        // condition for history queue
+pthread_rwlock_t rwlock_hs = PTHREAD_RWLOCK_INITIALIZER; // lock for history index (readers - queries)
+
+// Function that hashes bytes (FNV-1a), hash is never 0 because 0 marks empty slots
+uint64_t historyHash(uint64_t hash, const char *data, size_t len)
+{
+  if (hash == 0)
+    hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash ? hash : 1;
+}
+
+// Function that returns key of conversation between two users (order doesn't matter)
+uint64_t historyPairKey(const char *login_a, const char *login_b)
+{
+  if (strcmp(login_a, login_b) > 0)
+  {
+    const char *tmp = login_a;
+    login_a = login_b;
+    login_b = tmp;
+  }
+  uint64_t hash = historyHash(0, login_a, strlen(login_a) + 1);
+  return historyHash(hash, login_b, strlen(login_b));
+}
+
+// Function that finds slot of conversation in pair table
+struct history_pair *historyFindPair(uint64_t key)
+{
+  uint64_t mask = history.pairs_capacity - 1;
+  for (uint64_t i = key & mask;; i = (i + 1) & mask)
+  {
+    if (history.pairs[i].key == key || history.pairs[i].key == 0)
+      return &history.pairs[i];
+  }
+}
+
+// Function that returns newest entry of conversation
+uint64_t historyLastEntry(uint64_t key)
+{
+  if (history.pairs_capacity == 0)
+    return HISTORY_NONE;
+  struct history_pair *pair = historyFindPair(key);
+  return pair->key == key ? pair->last : HISTORY_NONE;
+}
+
+// Function that sets newest entry of conversation, table grows when half full
+bool historySetLastEntry(uint64_t key, uint64_t last)
+{
+  if ((history.pairs_count + 1) * 2 > history.pairs_capacity)
+  {
+    struct history_pair *old = history.pairs;
+    uint64_t old_capacity = history.pairs_capacity;
+    uint64_t capacity = old_capacity ? old_capacity * 2 : 1024;
+    struct history_pair *pairs = calloc(capacity, sizeof(struct history_pair));
+    if (!pairs)
+      return false;
+
+    history.pairs = pairs;
+    history.pairs_capacity = capacity;
+    for (uint64_t i = 0; i < old_capacity; i++)
+    {
+      if (old[i].key != 0)
+        *historyFindPair(old[i].key) = old[i];
+    }
+    free(old);
+  }
+
+  struct history_pair *pair = historyFindPair(key);
+  if (pair->key == 0)
+  {
+    pair->key = key;
+    history.pairs_count++;
+  }
+  pair->last = last;
+  return true;
+}
+
+// Function that finds slot of word in inverted index
+struct history_posting *historyFindWord(uint64_t word)
+{
+  uint64_t mask = history.words_capacity - 1;
+  for (uint64_t i = word & mask;; i = (i + 1) & mask)
+  {
+    if (history.words[i].word == word || history.words[i].word == 0)
+      return &history.words[i];
+  }
+}
+
+// Function that adds entry id to the posting list of a word
+bool historyAddPosting(uint64_t word, uint64_t id)
+{
+  if ((history.words_count + 1) * 2 > history.words_capacity)
+  {
+    struct history_posting *old = history.words;
+    uint64_t old_capacity = history.words_capacity;
+    uint64_t capacity = old_capacity ? old_capacity * 2 : 4096;
+    struct history_posting *words = calloc(capacity, sizeof(struct history_posting));
+    if (!words)
+      return false;
+
+    history.words = words;
+    history.words_capacity = capacity;
+    for (uint64_t i = 0; i < old_capacity; i++)
+    {
+      if (old[i].word != 0)
+        *historyFindWord(old[i].word) = old[i];
+    }
+    free(old);
+  }
+
+  struct history_posting *posting = historyFindWord(word);
+  if (posting->word == 0)
+  {
+    posting->word = word;
+    history.words_count++;
+  }
+  // the same word twice in one message
+  if (posting->count > 0 && posting->ids[posting->count - 1] == id)
+    return true;
+
+  if (posting->count == posting->capacity)
+  {
+    uint32_t capacity = posting->capacity ? posting->capacity * 2 : 4;
+    uint64_t *ids = realloc(posting->ids, capacity * sizeof(uint64_t));
+    if (!ids)
+      return false;
+    posting->ids = ids;
+    posting->capacity = capacity;
+  }
+  posting->ids[posting->count++] = id;
+  return true;
+}
+
+// Function that checks if byte is part of a word (non ascii bytes are treated as letters)
+bool historyIsWordChar(unsigned char c)
+{
+  return isalnum(c) || c >= 0x80;
+}
+
+// Function that returns key of a word in messages of a user (ascii letters are compared case insensitive)
+uint64_t historyWordHash(const char *login, const char *word, size_t len)
+{
+  uint64_t hash = historyHash(0, login, strlen(login) + 1);
+  for (size_t i = 0; i < len; i++)
+  {
+    char c = tolower((unsigned char)word[i]);
+    hash = historyHash(hash, &c, 1);
+  }
+  return hash;
+}
+
+// Function that adds all words of a message (at least 2 bytes long) to the inverted index
+// of both users of the conversation
+void historyIndexWords(uint64_t id, const char *from_login, const char *to_login, const char *message)
+{
+  const char *p = message;
+  while (*p)
+  {
+    while (*p && !historyIsWordChar(*p))
+      p++;
+    const char *start = p;
+    while (*p && historyIsWordChar(*p))
+      p++;
+    if (p - start >= 2)
+    {
+      historyAddPosting(historyWordHash(from_login, start, p - start), id);
+      if (strcmp(from_login, to_login) != 0)
+        historyAddPosting(historyWordHash(to_login, start, p - start), id);
+    }
+  }
+}
+
+// Function that checks if message contains given word (to filter out hash collisions)
+bool historyContainsWord(const char *message, const char *word)
+{
+  size_t len = strlen(word);
+  const char *p = message;
+  while (*p)
+  {
+    while (*p && !historyIsWordChar(*p))
+      p++;
+    const char *start = p;
+    while (*p && historyIsWordChar(*p))
+      p++;
+    if ((size_t)(p - start) == len && strncasecmp(start, word, len) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Function that parses a record from data at the start of `data`
+// returns size of the record or 0 if `data` doesn't hold a whole valid record
+size_t historyParseRecord(const char *data, size_t len, struct history_message *out)
+{
+  struct history_record record;
+  if (len < sizeof(record))
+    return 0;
+  memcpy(&record, data, sizeof(record));
+  if (record.from_len >= LOGIN_SIZE || record.to_len >= LOGIN_SIZE || record.message_len >= BUFFER_SIZE)
+    return 0;
+  size_t size = sizeof(record) + record.from_len + record.to_len + record.message_len;
+  if (len < size)
+    return 0;
+
+  data += sizeof(record);
+  memcpy(out->from_login, data, record.from_len);
+  out->from_login[record.from_len] = '\0';
+  data += record.from_len;
+  memcpy(out->to_login, data, record.to_len);
+  out->to_login[record.to_len] = '\0';
+  data += record.to_len;
+  memcpy(out->message, data, record.message_len);
+  out->message[record.message_len] = '\0';
+  out->timestamp = record.timestamp;
+  return size;
+}
+
+// Function that reads a record from the data file (with one read)
+bool historyReadRecord(uint64_t offset, struct history_message *out)
+{
+  char data[sizeof(struct history_record) + 2 * LOGIN_SIZE + BUFFER_SIZE];
+  ssize_t len = pread(history.data_fd, data, sizeof(data), offset);
+  return len > 0 && historyParseRecord(data, len, out) > 0;
+}
+
+// Function that rebuilds inverted index from the data file at startup
+// records lie one after another, so the file is read in big chunks instead of one read per record
+void historyRebuildWords()
+{
+  char *chunk = malloc(HISTORY_SCAN_CHUNK);
+  struct history_message *message = malloc(sizeof(struct history_message));
+  uint64_t chunk_offset = 0;
+  size_t chunk_len = 0;
+  for (uint64_t id = 0; chunk && message && id < history.header->count; id++)
+  {
+    uint64_t offset = history.index[id].offset;
+    bool in_chunk = offset >= chunk_offset && offset < chunk_offset + chunk_len;
+    size_t size = in_chunk ? historyParseRecord(chunk + (offset - chunk_offset),
+                                                chunk_len - (offset - chunk_offset), message)
+                           : 0;
+    // record isn't (whole) in the chunk, read next chunk from its start
+    if (size == 0)
+    {
+      ssize_t len = pread(history.data_fd, chunk, HISTORY_SCAN_CHUNK, offset);
+      chunk_offset = offset;
+      chunk_len = len > 0 ? len : 0;
+      size = historyParseRecord(chunk, chunk_len, message);
+    }
+    if (size > 0)
+      historyIndexWords(id, message->from_login, message->to_login, message->message);
+  }
+  free(message);
+  free(chunk);
+}
+
+// Function that maps index file so it can hold at least `needed` entries
+// only the writer thread (or startup code) calls it
+bool historyMapIndex(uint64_t needed)
+{
+  if (history.header && needed <= history.capacity)
+    return true;
+
+  uint64_t capacity = (needed + HISTORY_INDEX_CHUNK - 1) / HISTORY_INDEX_CHUNK * HISTORY_INDEX_CHUNK;
+  size_t size = (capacity + 1) * sizeof(struct history_index_entry);
+
+  pthread_rwlock_wrlock(&rwlock_hs);
+  bool ok = ftruncate(history.index_fd, size) == 0;
+  if (ok)
+  {
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, history.index_fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+      ok = false;
+    }
+    else
+    {
+      if (history.header)
+        munmap(history.header, (history.capacity + 1) * sizeof(struct history_index_entry));
+      history.header = mapping;
+      history.index = (struct history_index_entry *)mapping + 1;
+      history.capacity = capacity;
+    }
+  }
+  pthread_rwlock_unlock(&rwlock_hs);
+
+  if (!ok)
+    perror("Nie można zmapować indeksu historii");
+  return ok;
+}
+
+// Function that writes a batch of delivered messages to history and frees them
+void historyWriteBatch(struct stailhead *batch)
+{
+  // serialize all records into one buffer, so the batch is written with one syscall
+  size_t total = 0;
+  uint64_t count = 0;
+  struct entry *message;
+  STAILQ_FOREACH(message, batch, entries)
+  {
+    total += sizeof(struct history_record) + strlen(message->from_login) +
+             strlen(message->to_login) + strlen(message->message);
+    count++;
+  }
+
+  char *buffer = malloc(total);
+  bool ok = buffer != NULL && historyMapIndex(history.header->count + count);
+  size_t written = 0;
+  uint64_t data_size = history.header->data_size;
+
+  if (ok)
+  {
+    size_t pos = 0;
+    STAILQ_FOREACH(message, batch, entries)
+    {
+      struct history_record record = {0};
+      record.timestamp = message->timestamp;
+      record.from_len = strlen(message->from_login);
+      record.to_len = strlen(message->to_login);
+      record.message_len = strlen(message->message);
+      memcpy(buffer + pos, &record, sizeof(record));
+      pos += sizeof(record);
+      memcpy(buffer + pos, message->from_login, record.from_len);
+      pos += record.from_len;
+      memcpy(buffer + pos, message->to_login, record.to_len);
+      pos += record.to_len;
+      memcpy(buffer + pos, message->message, record.message_len);
+      pos += record.message_len;
+    }
+
+    while (written < total)
+    {
+      ssize_t n = pwrite(history.data_fd, buffer + written, total - written, data_size + written);
+      if (n <= 0)
+      {
+        perror("Błąd zapisu historii");
+        ok = false;
+        break;
+      }
+      written += n;
+    }
+  }
+
+  // publish the batch in the index
+  if (ok)
+  {
+    pthread_rwlock_wrlock(&rwlock_hs);
+    uint64_t id = history.header->count;
+    uint64_t offset = data_size;
+    STAILQ_FOREACH(message, batch, entries)
+    {
+      struct history_index_entry *index_entry = &history.index[id];
+      index_entry->pair_key = historyPairKey(message->from_login, message->to_login);
+      index_entry->offset = offset;
+      index_entry->prev = historyLastEntry(index_entry->pair_key);
+      // chain of a conversation stays ordered by timestamp, so range queries can stop at the
+      // first older entry; message written late (from offline queue, or after the clock
+      // stepped back) is indexed with the time of the newest entry, the record keeps its own
+      index_entry->timestamp = message->timestamp;
+      if (index_entry->prev != HISTORY_NONE && history.index[index_entry->prev].timestamp > index_entry->timestamp)
+        index_entry->timestamp = history.index[index_entry->prev].timestamp;
+      historySetLastEntry(index_entry->pair_key, id);
+      if (HISTORY_SEARCH)
+        historyIndexWords(id, message->from_login, message->to_login, message->message);
+
+      offset += sizeof(struct history_record) + strlen(message->from_login) +
+                strlen(message->to_login) + strlen(message->message);
+      id++;
+    }
+    history.header->count = id;
+    history.header->data_size = offset;
+    pthread_rwlock_unlock(&rwlock_hs);
+  }
+
+  free(buffer);
+  while (!STAILQ_EMPTY(batch))
+  {
+    message = STAILQ_FIRST(batch);
+    STAILQ_REMOVE_HEAD(batch, entries);
+    freeEntry(message);
+  }
+}
+
+// thread that writes delivered messages to history in batches
+void *historyWriterThread(void *args)
+{
+  while (true)
+  {
+    struct stailhead batch = STAILQ_HEAD_INITIALIZER(batch);
+
+    pthread_mutex_lock(&mutex_hq);
+    while (STAILQ_EMPTY(&history_queue) && server_running)
+    {
+      pthread_cond_wait(&cond_hq, &mutex_hq);
+    }
+
+    // take everything that is waiting, pending messages are still written on shutdown
+    if (STAILQ_EMPTY(&history_queue))
+    {
+      pthread_mutex_unlock(&mutex_hq);
+      break;
+    }
+    STAILQ_CONCAT(&batch, &history_queue);
+    pthread_mutex_unlock(&mutex_hq);
+
+    historyWriteBatch(&batch);
+  }
+  return NULL;
+}
+
+// Function that hands a delivered message over to the history writer (takes ownership)
+void historyAppend(struct entry *message)
+{
+  if (!history.enabled)
+  {
+    freeEntry(message);
+    return;
+  }
+
+  pthread_mutex_lock(&mutex_hq);
+  STAILQ_INSERT_TAIL(&history_queue, message, entries);
+  pthread_cond_signal(&cond_hq);
+  pthread_mutex_unlock(&mutex_hq);
+}
+
+// Function that opens history files, rebuilds in-memory indexes and starts the writer thread
+bool historyOpen()
+{
+  history.data_fd = open(HISTORY_DATA_FILE, O_RDWR | O_CREAT, 0644);
+  history.index_fd = open(HISTORY_INDEX_FILE, O_RDWR | O_CREAT, 0644);
+  if (history.data_fd < 0 || history.index_fd < 0)
+  {
+    perror("Nie można otworzyć plików historii");
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(history.index_fd, &st) < 0)
+  {
+    perror("Nie można odczytać indeksu historii");
+    return false;
+  }
+
+  uint64_t existing = st.st_size / sizeof(struct history_index_entry);
+  if (!historyMapIndex(existing > 1 ? existing - 1 : 1))
+    return false;
+
+  // new (or unknown) index file
+  if (history.header->magic != HISTORY_MAGIC)
+  {
+    history.header->magic = HISTORY_MAGIC;
+    history.header->count = 0;
+    history.header->data_size = 0;
+  }
+
+  // drop records that were written but never published in the index
+  if (ftruncate(history.data_fd, history.header->data_size) < 0)
+  {
+    perror("Nie można przyciąć pliku historii");
+    return false;
+  }
+
+  // rebuild conversation table and inverted index
+  for (uint64_t id = 0; id < history.header->count; id++)
+  {
+    historySetLastEntry(history.index[id].pair_key, id);
+  }
+  if (HISTORY_SEARCH)
+    historyRebuildWords();
+
+  if (pthread_create(&history.writer, NULL, historyWriterThread, NULL) != 0)
+  {
+    perror("Nie można utworzyć wątku zapisującego historię");
+    return false;
+  }
+
+  history.enabled = true;
+  printf("Wczytano historię: %llu wiadomości\n", (unsigned long long)history.header->count);
+  return true;
+}
+
+// Function that flushes pending messages and closes history
+void historyClose()
+{
+  if (!history.enabled)
+    return;
+  history.enabled = false;
+
+  pthread_mutex_lock(&mutex_hq);
+  pthread_cond_signal(&cond_hq);
+  pthread_mutex_unlock(&mutex_hq);
+  pthread_join(history.writer, NULL);
+
+  munmap(history.header, (history.capacity + 1) * sizeof(struct history_index_entry));
+  history.header = NULL;
+  close(history.index_fd);
+  close(history.data_fd);
+}
+
+// Function that sends one history message to the client
+void historySendMessage(int socket, const struct history_message *message)
+{
+  char date[32];
+  time_t seconds = message->timestamp / 1000;
+  struct tm tm;
+  localtime_r(&seconds, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+  char line[BUFFER_SIZE + 2 * LOGIN_SIZE + 64];
+  snprintf(line, sizeof(line), "[%s] %s -> %s: %s\n", date,
+           message->from_login, message->to_login, message->message);
+  send(socket, line, strlen(line), 0);
+}
+
+// Function that sends messages between two users with timestamp in [from_ts, to_ts]
+// skips `skip` newest matching messages and sends at most `limit` (oldest first)
+// `paged` tells if the command has page argument (otherwise older messages are
+// available only through the time range form)
+void historyQuery(int socket, const char *login, const char *peer,
+                  uint64_t from_ts, uint64_t to_ts, uint64_t skip, uint64_t limit, bool paged)
+{
+  if (!history.enabled)
+  {
+    const char *msg = "Historia wiadomości jest niedostępna\n";
+    send(socket, msg, strlen(msg), 0);
+    return;
+  }
+
+  // collect offsets of matching records (newest first) under read lock
+  // one more than limit is collected to know if there is next page
+  uint64_t *offsets = malloc((limit + 1) * sizeof(uint64_t));
+  if (!offsets)
+    return;
+  uint64_t found = 0;
+  uint64_t key = historyPairKey(login, peer);
+
+  pthread_rwlock_rdlock(&rwlock_hs);
+  for (uint64_t id = historyLastEntry(key); id != HISTORY_NONE && found <= limit; id = history.index[id].prev)
+  {
+    struct history_index_entry *index_entry = &history.index[id];
+    if (index_entry->timestamp > to_ts)
+      continue;
+    // chain is ordered by index timestamp (see historyWriteBatch)
+    if (index_entry->timestamp < from_ts)
+      break;
+    if (skip > 0)
+    {
+      skip--;
+      continue;
+    }
+    offsets[found++] = index_entry->offset;
+  }
+  pthread_rwlock_unlock(&rwlock_hs);
+
+  bool has_more = found > limit;
+  if (has_more)
+    found = limit;
+
+  // data file is append only, so records can be read without the lock
+  struct history_message *message = malloc(sizeof(struct history_message));
+  uint64_t sent = 0;
+  for (uint64_t i = found; message && i > 0; i--)
+  {
+    if (!historyReadRecord(offsets[i - 1], message))
+      continue;
+    // different conversation with the same key
+    bool matches = (strcmp(message->from_login, login) == 0 && strcmp(message->to_login, peer) == 0) ||
+                   (strcmp(message->from_login, peer) == 0 && strcmp(message->to_login, login) == 0);
+    if (!matches)
+      continue;
+    historySendMessage(socket, message);
+    sent++;
+  }
+  free(message);
+  free(offsets);
+
+  const char *more = "";
+  if (has_more)
+    more = paged ? " (są kolejne strony)" : " (są starsze wiadomości: h <login> <od> <do> [strona])";
+  char summary[128];
+  snprintf(summary, sizeof(summary), "Znaleziono wiadomości: %llu%s\n", (unsigned long long)sent, more);
+  send(socket, summary, strlen(summary), 0);
+}
+
+// Function that sends one page of messages of the user containing given word (newest first)
+void historySearch(int socket, const char *login, const char *word, uint64_t page)
+{
+  if (!history.enabled || !HISTORY_SEARCH)
+  {
+    const char *msg = "Wyszukiwanie w historii jest niedostępne\n";
+    send(socket, msg, strlen(msg), 0);
+    return;
+  }
+
+  // copy posting list under read lock
+  uint64_t *ids = NULL;
+  uint64_t count = 0;
+  pthread_rwlock_rdlock(&rwlock_hs);
+  if (history.words_capacity > 0)
+  {
+    struct history_posting *posting = historyFindWord(historyWordHash(login, word, strlen(word)));
+    if (posting->word != 0 && posting->count > 0)
+    {
+      ids = malloc(posting->count * sizeof(uint64_t));
+      if (ids)
+      {
+        count = posting->count;
+        for (uint64_t i = 0; i < count; i++)
+          ids[i] = history.index[posting->ids[i]].offset;
+      }
+    }
+  }
+  pthread_rwlock_unlock(&rwlock_hs);
+
+  struct history_message *message = malloc(sizeof(struct history_message));
+  uint64_t skip = page * HISTORY_PAGE_SIZE;
+  uint64_t sent = 0;
+  bool has_more = false;
+  for (uint64_t i = count; message && i > 0; i--)
+  {
+    if (!historyReadRecord(ids[i - 1], message))
+      continue;
+    // only user's own conversations
+    if (strcmp(message->from_login, login) != 0 && strcmp(message->to_login, login) != 0)
+      continue;
+    if (!historyContainsWord(message->message, word))
+      continue;
+    if (skip > 0)
+    {
+      skip--;
+      continue;
+    }
+    if (sent == HISTORY_PAGE_SIZE)
+    {
+      has_more = true;
+      break;
+    }
+    historySendMessage(socket, message);
+    sent++;
+  }
+  free(message);
+  free(ids);
+
+  char summary[128];
+  snprintf(summary, sizeof(summary), "Znaleziono wiadomości: %llu%s\n", (unsigned long long)sent,
+           has_more ? " (są kolejne strony)" : "");
+  send(socket, summary, strlen(summary), 0);
+}
+
+// ---------------------------------------------------------------------------
+// Password hashing
+//
+// Passwords are hashed with scrypt (RFC 7914), which needs 128 * r * N bytes
+// of memory per hash, so guessing passwords is expensive also on GPUs.
+// SHA-256 / PBKDF2 are implemented here to keep the server dependency free.
+// ---------------------------------------------------------------------------
+
+struct sha256_ctx
+{
+  uint32_t state[8];
+  uint64_t length; // total bytes
+  uint8_t block[64];
+  size_t used; // bytes in block
+};
+
+const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// Function that processes one 64 byte block
+void sha256Transform(struct sha256_ctx *ctx, const uint8_t *block)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+           (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; i++)
+  {
+    uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+  uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+    uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+  ctx->state[5] += f;
+  ctx->state[6] += g;
+  ctx->state[7] += h;
+}
+
+void sha256Init(struct sha256_ctx *ctx)
+{
+  static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  memcpy(ctx->state, init, sizeof(init));
+  ctx->length = 0;
+  ctx->used = 0;
+}
+
+void sha256Update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+  const uint8_t *bytes = data;
+  ctx->length += len;
+  while (len > 0)
+  {
+    size_t chunk = 64 - ctx->used < len ? 64 - ctx->used : len;
+    memcpy(ctx->block + ctx->used, bytes, chunk);
+    ctx->used += chunk;
+    bytes += chunk;
+    len -= chunk;
+    if (ctx->used == 64)
+    {
+      sha256Transform(ctx, ctx->block);
+      ctx->used = 0;
+    }
+  }
+}
+
+void sha256Final(struct sha256_ctx *ctx, uint8_t out[32])
+{
+  uint64_t bits = ctx->length * 8;
+  uint8_t padding = 0x80;
+  sha256Update(ctx, &padding, 1);
+  padding = 0;
+  while (ctx->used != 56)
+  {
+    sha256Update(ctx, &padding, 1);
+  }
+  uint8_t length[8];
+  for (int i = 0; i < 8; i++)
+  {
+    length[i] = bits >> (56 - 8 * i);
+  }
+  sha256Update(ctx, length, 8);
+
+  for (int i = 0; i < 8; i++)
+  {
+    out[i * 4] = ctx->state[i] >> 24;
+    out[i * 4 + 1] = ctx->state[i] >> 16;
+    out[i * 4 + 2] = ctx->state[i] >> 8;
+    out[i * 4 + 3] = ctx->state[i];
+  }
+}
+
+// Function that computes SHA-256 of data
+void sha256(const void *data, size_t len, uint8_t out[32])
+{
+  struct sha256_ctx ctx;
+  sha256Init(&ctx);
+  sha256Update(&ctx, data, len);
+  sha256Final(&ctx, out);
+}
+
+// Function that derives key with PBKDF2-HMAC-SHA256
+void pbkdf2Sha256(const uint8_t *password, size_t password_len, const uint8_t *salt, size_t salt_len,
+                  uint32_t iterations, uint8_t *out, size_t out_len)
+{
+  // HMAC key longer than block is hashed first
+  uint8_t key[64] = {0};
+  if (password_len > 64)
+    sha256(password, password_len, key);
+  else
+    memcpy(key, password, password_len);
+
+  uint8_t ipad[64], opad[64];
+  for (int i = 0; i < 64; i++)
+  {
+    ipad[i] = key[i] ^ 0x36;
+    opad[i] = key[i] ^ 0x5c;
+  }
+
+  // contexts with the key already absorbed, copied for every HMAC
+  struct sha256_ctx inner, outer;
+  sha256Init(&inner);
+  sha256Update(&inner, ipad, 64);
+  sha256Init(&outer);
+  sha256Update(&outer, opad, 64);
+
+  for (uint32_t block = 1; out_len > 0; block++)
+  {
+    uint8_t counter[4] = {block >> 24, block >> 16, block >> 8, block};
+    uint8_t u[32], t[32];
+
+    struct sha256_ctx ctx = inner;
+    sha256Update(&ctx, salt, salt_len);
+    sha256Update(&ctx, counter, 4);
+    sha256Final(&ctx, u);
+    ctx = outer;
+    sha256Update(&ctx, u, 32);
+    sha256Final(&ctx, u);
+    memcpy(t, u, 32);
+
+    for (uint32_t i = 1; i < iterations; i++)
+    {
+      ctx = inner;
+      sha256Update(&ctx, u, 32);
+      sha256Final(&ctx, u);
+      ctx = outer;
+      sha256Update(&ctx, u, 32);
+      sha256Final(&ctx, u);
+      for (int j = 0; j < 32; j++)
+        t[j] ^= u[j];
+    }
+
+    size_t chunk = out_len < 32 ? out_len : 32;
+    memcpy(out, t, chunk);
+    out += chunk;
+    out_len -= chunk;
+  }
+}
+
+// Function that applies Salsa20/8 core to 16 words
+void salsa208(uint32_t b[16])
+{
+  uint32_t x[16];
+  memcpy(x, b, sizeof(x));
+  for (int i = 0; i < 8; i += 2)
+  {
+    x[4] ^= ROTL32(x[0] + x[12], 7);
+    x[8] ^= ROTL32(x[4] + x[0], 9);
+    x[12] ^= ROTL32(x[8] + x[4], 13);
+    x[0] ^= ROTL32(x[12] + x[8], 18);
+    x[9] ^= ROTL32(x[5] + x[1], 7);
+    x[13] ^= ROTL32(x[9] + x[5], 9);
+    x[1] ^= ROTL32(x[13] + x[9], 13);
+    x[5] ^= ROTL32(x[1] + x[13], 18);
+    x[14] ^= ROTL32(x[10] + x[6], 7);
+    x[2] ^= ROTL32(x[14] + x[10], 9);
+    x[6] ^= ROTL32(x[2] + x[14], 13);
+    x[10] ^= ROTL32(x[6] + x[2], 18);
+    x[3] ^= ROTL32(x[15] + x[11], 7);
+    x[7] ^= ROTL32(x[3] + x[15], 9);
+    x[11] ^= ROTL32(x[7] + x[3], 13);
+    x[15] ^= ROTL32(x[11] + x[7], 18);
+    x[1] ^= ROTL32(x[0] + x[3], 7);
+    x[2] ^= ROTL32(x[1] + x[0], 9);
+    x[3] ^= ROTL32(x[2] + x[1], 13);
+    x[0] ^= ROTL32(x[3] + x[2], 18);
+    x[6] ^= ROTL32(x[5] + x[4], 7);
+    x[7] ^= ROTL32(x[6] + x[5], 9);
+    x[4] ^= ROTL32(x[7] + x[6], 13);
+    x[5] ^= ROTL32(x[4] + x[7], 18);
+    x[11] ^= ROTL32(x[10] + x[9], 7);
+    x[8] ^= ROTL32(x[11] + x[10], 9);
+    x[9] ^= ROTL32(x[8] + x[11], 13);
+    x[10] ^= ROTL32(x[9] + x[8], 18);
+    x[12] ^= ROTL32(x[15] + x[14], 7);
+    x[13] ^= ROTL32(x[12] + x[15], 9);
+    x[14] ^= ROTL32(x[13] + x[12], 13);
+    x[15] ^= ROTL32(x[14] + x[13], 18);
+  }
+  for (int i = 0; i < 16; i++)
+    b[i] += x[i];
+}
+
+// Function that mixes 2 * r blocks of 16 words from `in` into `out` (scryptBlockMix)
+void scryptBlockMix(const uint32_t *in, uint32_t *out, uint32_t r)
+{
+  uint32_t x[16];
+  memcpy(x, &in[(2 * r - 1) * 16], sizeof(x));
+  for (uint32_t i = 0; i < 2 * r; i++)
+  {
+    for (int j = 0; j < 16; j++)
+      x[j] ^= in[i * 16 + j];
+    salsa208(x);
+    // even blocks go to the first half of output, odd to the second
+    memcpy(&out[((i & 1) * r + i / 2) * 16], x, sizeof(x));
+  }
+}
+
+// Function that computes scrypt hash, returns false if memory can't be allocated
+bool scrypt(const char *password, const uint8_t *salt, size_t salt_len,
+            uint64_t n, uint32_t r, uint32_t p, uint8_t *out, size_t out_len)
+{
+  size_t block_words = 32 * r; // 128 * r bytes
+  uint8_t *b = malloc(p * block_words * 4);
+  uint32_t *v = malloc(n * block_words * 4);
+  uint32_t *x = malloc(block_words * 4);
+  uint32_t *y = malloc(block_words * 4);
+  if (!b || !v || !x || !y)
+  {
+    free(b);
+    free(v);
+    free(x);
+    free(y);
+    return false;
+  }
+
+  pbkdf2Sha256((const uint8_t *)password, strlen(password), salt, salt_len, 1, b, p * block_words * 4);
+
+  for (uint32_t i = 0; i < p; i++)
+  {
+    uint8_t *block = b + i * block_words * 4;
+    for (size_t k = 0; k < block_words; k++)
+    {
+      x[k] = (uint32_t)block[k * 4] | (uint32_t)block[k * 4 + 1] << 8 |
+             (uint32_t)block[k * 4 + 2] << 16 | (uint32_t)block[k * 4 + 3] << 24;
+    }
+
+    // fill memory with sequential hashes, then read it in data dependent order
+    for (uint64_t j = 0; j < n; j++)
+    {
+      memcpy(&v[j * block_words], x, block_words * 4);
+      scryptBlockMix(x, y, r);
+      memcpy(x, y, block_words * 4);
+    }
+    for (uint64_t j = 0; j < n; j++)
+    {
+      uint64_t index = x[(2 * r - 1) * 16] & (n - 1);
+      for (size_t k = 0; k < block_words; k++)
+        x[k] ^= v[index * block_words + k];
+      scryptBlockMix(x, y, r);
+      memcpy(x, y, block_words * 4);
+    }
+
+    for (size_t k = 0; k < block_words; k++)
+    {
+      block[k * 4] = x[k];
+      block[k * 4 + 1] = x[k] >> 8;
+      block[k * 4 + 2] = x[k] >> 16;
+      block[k * 4 + 3] = x[k] >> 24;
+    }
+  }
+
+  pbkdf2Sha256((const uint8_t *)password, strlen(password), b, p * block_words * 4, 1, out, out_len);
+
+  free(b);
+  free(v);
+  free(x);
+  free(y);
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// Accounts
+//
+// Credentials are kept in CREDENTIALS_FILE, one account per line:
+//   <login> <N> <r> <p> <salt hex> <hash hex>
+// Hashing runs on a bounded pool of HASH_WORKERS threads, so a burst of logins
+// uses at most HASH_WORKERS * 128 * r * N bytes and can't exhaust the server.
+// After successful login client gets a session token; logging in with the token
+// ("t <login> <token>") needs only one SHA-256 instead of scrypt.
+// ---------------------------------------------------------------------------
+
+struct credential
+{
+  char login[LOGIN_SIZE];
+  uint64_t n;
+  uint32_t r;
+  uint32_t p;
+  uint8_t salt[SALT_SIZE];
+  uint8_t hash[HASH_SIZE];
+  // SHA-256 of the last session token and its expiry time (ms since epoch)
+  uint8_t token_hash[HASH_SIZE];
+  uint64_t token_expires;
+};
+
+// array of accounts
+struct credential *credentials = NULL;
+size_t num_of_credentials = 0;
+size_t credentials_capacity = 0;
+
+pthread_mutex_t mutex_cr = PTHREAD_MUTEX_INITIALIZER; // mutex for credentials
+
+// hashing request that waits in the pool queue
+struct hash_job
+{
+  const char *password;
+  const uint8_t *salt;
+  uint64_t n;
+  uint32_t r;
+  uint32_t p;
+  uint8_t hash[HASH_SIZE];
+  bool done;
+  bool ok;
+  STAILQ_ENTRY(hash_job)
+  entries;
+};
+
+STAILQ_HEAD(hash_job_queue, hash_job);
+
+struct hash_job_queue hash_queue = STAILQ_HEAD_INITIALIZER(hash_queue);
+int hash_queue_length = 0;
+pthread_t hash_workers[HASH_WORKERS];
+
+pthread_mutex_t mutex_hp = PTHREAD_MUTEX_INITIALIZER; // mutex for hash pool
+pthread_cond_t cond_hp = PTHREAD_COND_INITIALIZER;    // condition for new hashing job
+pthread_cond_t cond_hd = PTHREAD_COND_INITIALIZER;    // condition for finished hashing job
+
+// Function that fills buffer with random bytes from the system
+bool randomBytes(uint8_t *out, size_t len)
+{
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0)
+    return false;
+  size_t got = 0;
+  while (got < len)
+  {
+    ssize_t n = read(fd, out + got, len - got);
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  close(fd);
+  return got == len;
+}
+
+// Function that writes bytes as hex string (out must have 2 * len + 1 bytes)
+void toHex(const uint8_t *data, size_t len, char *out)
+{
+  for (size_t i = 0; i < len; i++)
+    sprintf(out + i * 2, "%02x", data[i]);
+}
+
+// Function that parses hex string into exactly len bytes
+bool fromHex(const char *hex, uint8_t *out, size_t len)
+{
+  if (strlen(hex) != len * 2)
+    return false;
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned int byte;
+    if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+      return false;
+    out[i] = byte;
+  }
+  return true;
+}
+
+// Function that compares buffers in time that doesn't depend on their content
+bool constantTimeEqual(const uint8_t *a, const uint8_t *b, size_t len)
+{
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i++)
+    diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+// thread that computes password hashes
+void *hashWorkerThread(void *args)
+{
+  while (true)
+  {
+    pthread_mutex_lock(&mutex_hp);
+    while (STAILQ_EMPTY(&hash_queue) && server_running)
+    {
+      pthread_cond_wait(&cond_hp, &mutex_hp);
+    }
+    if (!server_running)
+    {
+      pthread_mutex_unlock(&mutex_hp);
+      break;
+    }
+    struct hash_job *job = STAILQ_FIRST(&hash_queue);
+    STAILQ_REMOVE_HEAD(&hash_queue, entries);
+    hash_queue_length--;
+    pthread_mutex_unlock(&mutex_hp);
+
+    bool ok = scrypt(job->password, job->salt, SALT_SIZE, job->n, job->r, job->p, job->hash, HASH_SIZE);
+
+    pthread_mutex_lock(&mutex_hp);
+    job->ok = ok;
+    job->done = true;
+    pthread_cond_broadcast(&cond_hd);
+    pthread_mutex_unlock(&mutex_hp);
+  }
+  return NULL;
+}
+
+// Function that hashes password on the worker pool and waits for the result
+// returns false if the pool queue is full or hashing failed
+bool hashPassword(const char *password, const uint8_t *salt, uint64_t n, uint32_t r, uint32_t p,
+                  uint8_t out[HASH_SIZE])
+{
+  struct hash_job job = {password, salt, n, r, p};
+
+  pthread_mutex_lock(&mutex_hp);
+  if (hash_queue_length >= HASH_QUEUE_SIZE)
+  {
+    pthread_mutex_unlock(&mutex_hp);
+    return false;
+  }
+  STAILQ_INSERT_TAIL(&hash_queue, &job, entries);
+  hash_queue_length++;
+  pthread_cond_signal(&cond_hp);
+  while (!job.done)
+  {
+    pthread_cond_wait(&cond_hd, &mutex_hp);
+  }
+  pthread_mutex_unlock(&mutex_hp);
+
+  if (job.ok)
+    memcpy(out, job.hash, HASH_SIZE);
+  return job.ok;
+}
+
+// Function that starts hashing threads
+bool startHashWorkers()
+{
+  for (int i = 0; i < HASH_WORKERS; i++)
+  {
+    if (pthread_create(&hash_workers[i], NULL, hashWorkerThread, NULL) != 0)
+      return false;
+    pthread_detach(hash_workers[i]);
+  }
+  return true;
+}
+
+// Function that finds account with given login (mutex_cr must be held)
+struct credential *findCredential(const char *login)
+{
+  for (size_t i = 0; i < num_of_credentials; i++)
+  {
+    if (strcmp(credentials[i].login, login) == 0)
+      return &credentials[i];
+  }
+  return NULL;
+}
+
+// Function that adds account to the array (mutex_cr must be held)
+struct credential *addCredential(const struct credential *credential)
+{
+  if (num_of_credentials == credentials_capacity)
+  {
+    size_t capacity = credentials_capacity ? credentials_capacity * 2 : 64;
+    struct credential *resized = realloc(credentials, capacity * sizeof(struct credential));
+    if (!resized)
+      return NULL;
+    credentials = resized;
+    credentials_capacity = capacity;
+  }
+  credentials[num_of_credentials] = *credential;
+  return &credentials[num_of_credentials++];
+}
+
+// Function that loads accounts from the credentials file
+void loadCredentials()
+{
+  FILE *file = fopen(CREDENTIALS_FILE, "r");
+  if (!file)
+    return;
+
+  char line[LOGIN_SIZE + 256];
+  while (fgets(line, sizeof(line), file))
+  {
+    struct credential credential = {0};
+    unsigned long long n;
+    char salt_hex[SALT_SIZE * 2 + 2], hash_hex[HASH_SIZE * 2 + 2];
+    if (sscanf(line, "%255s %llu %u %u %33s %65s", credential.login, &n, &credential.r, &credential.p,
+               salt_hex, hash_hex) != 6 ||
+        !fromHex(salt_hex, credential.salt, SALT_SIZE) || !fromHex(hash_hex, credential.hash, HASH_SIZE))
+    {
+      printf("BŁĄD: Nieprawidłowy wpis w pliku %s\n", CREDENTIALS_FILE);
+      continue;
+    }
+    credential.n = n;
+    addCredential(&credential);
+  }
+  fclose(file);
+  printf("Wczytano konta: %zu\n", num_of_credentials);
+}
+
+// Function that appends account to the credentials file (mutex_cr must be held)
+bool saveCredential(const struct credential *credential)
+{
+  FILE *file = fopen(CREDENTIALS_FILE, "a");
+  if (!file)
+    return false;
+
+  char salt_hex[SALT_SIZE * 2 + 1], hash_hex[HASH_SIZE * 2 + 1];
+  toHex(credential->salt, SALT_SIZE, salt_hex);
+  toHex(credential->hash, HASH_SIZE, hash_hex);
+  fprintf(file, "%s %llu %u %u %s %s\n", credential->login, (unsigned long long)credential->n,
+          credential->r, credential->p, salt_hex, hash_hex);
+  return fclose(file) == 0;
+}
+
+// Function that checks password of an existing account or creates a new account
+bool authenticatePassword(const char *login, const char *password, bool *overloaded)
+{
+  struct credential credential = {0};
+  pthread_mutex_lock(&mutex_cr);
+  struct credential *existing = findCredential(login);
+  if (existing)
+    credential = *existing;
+  pthread_mutex_unlock(&mutex_cr);
+
+  // login without account - register it with given password
+  if (!existing)
+  {
+    strncpy(credential.login, login, LOGIN_SIZE - 1);
+    credential.n = SCRYPT_N;
+    credential.r = SCRYPT_R;
+    credential.p = SCRYPT_P;
+    if (!randomBytes(credential.salt, SALT_SIZE))
+      return false;
+  }
+
+  uint8_t hash[HASH_SIZE];
+  if (!hashPassword(password, credential.salt, credential.n, credential.r, credential.p, hash))
+  {
+    *overloaded = true;
+    return false;
+  }
+
+  if (existing)
+    return constantTimeEqual(hash, credential.hash, HASH_SIZE);
+
+  memcpy(credential.hash, hash, HASH_SIZE);
+  pthread_mutex_lock(&mutex_cr);
+  // someone registered the same login in the meantime
+  bool ok = findCredential(login) == NULL && saveCredential(&credential) && addCredential(&credential);
+  pthread_mutex_unlock(&mutex_cr);
+  if (ok)
+    printf("Utworzono konto '%s'\n", login);
+  return ok;
+}
+
+// Function that checks session token of an account
+bool authenticateToken(const char *login, const char *token)
+{
+  uint8_t token_bytes[TOKEN_SIZE], token_hash[HASH_SIZE];
+  if (!fromHex(token, token_bytes, TOKEN_SIZE))
+    return false;
+  sha256(token_bytes, TOKEN_SIZE, token_hash);
+
+  pthread_mutex_lock(&mutex_cr);
+  struct credential *credential = findCredential(login);
+  bool ok = credential && credential->token_expires > currentTimeMs() &&
+            constantTimeEqual(credential->token_hash, token_hash, HASH_SIZE);
+  pthread_mutex_unlock(&mutex_cr);
+  return ok;
+}
+
+// Function that creates new session token for an account (replaces the previous one)
+// token is written as hex into `out` (2 * TOKEN_SIZE + 1 bytes)
+bool issueToken(const char *login, char *out)
+{
+  uint8_t token[TOKEN_SIZE];
+  if (!randomBytes(token, TOKEN_SIZE))
+    return false;
+
+  pthread_mutex_lock(&mutex_cr);
+  struct credential *credential = findCredential(login);
+  if (credential)
+  {
+    sha256(token, TOKEN_SIZE, credential->token_hash);
+    credential->token_expires = currentTimeMs() + TOKEN_TTL_MS;
+  }
+  pthread_mutex_unlock(&mutex_cr);
+
+  toHex(token, TOKEN_SIZE, out);
+  return credential != NULL;
+}
+
+// Function that ends unsuccessful logging in (sends reason if given), always returns false
+bool rejectLogin(struct client *cl, const char *msg)
+{
+  if (msg)
+    send(cl->socket, msg, strlen(msg), 0);
+  timerCancel(&cl->timer);
+  closeGracefully(cl->socket);
+  free(cl);
+  return false;
+}
+
+// Function that sends new session token to the client
+void sendSessionToken(struct client *client)
+{
+  char token[TOKEN_SIZE * 2 + 1];
+  if (!issueToken(client->login, token))
+    return;
+
+  char msg[BUFFER_SIZE];
+  snprintf(msg, BUFFER_SIZE, "Token sesji: %s (ponowne logowanie: t <login> <token>)\n", token);
+  send(client->socket, msg, strlen(msg), 0);
+}
+
+// Function that ends the old session of the account when its owner logs in again
+// (e.g. after network failure, before the idle timeout notices the dead connection)
+// returns false if the old session didn't end in time (mutex_cl must be held)
+bool takeOverSession(struct client *client)
 {
-  // while queue is not empty
-  while (!STAILQ_EMPTY(&client->queue))
+  if (!client->is_logged_in)
+    return true;
+
+  printf("Klient '%s' zalogował się ponownie, zamykanie poprzedniej sesji\n", client->login);
+  const char *msg = "Zalogowano na to konto z innego połączenia\n";
+  send(client->socket, msg, strlen(msg), MSG_DONTWAIT);
+  // client thread of the old session wakes up and logs it out
+  shutdown(client->socket, SHUT_RDWR);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += TAKEOVER_TIMEOUT_MS / 1000;
+  while (client->is_logged_in)
   {
-    // pop the message from the personal queue to the global queue (to be sent)
-    struct entry *message = STAILQ_FIRST(&client->queue);
-    addMessageToQueue(message->from_login, message->to_login, message->message);
-    STAILQ_REMOVE_HEAD(&client->queue, entries);
+    if (pthread_cond_timedwait(&cond_cl, &mutex_cl, &deadline) == ETIMEDOUT)
+      break;
   }
+  return !client->is_logged_in;
 }
 
-// Function that handles loggin in
-bool handleLoggingIn(int *client_socket, struct client **new_client)
+// Function that handles loggin in of a connection whose login data were already received
+// (so a worker never waits for the user), checks token or password and starts the session
+bool handleLoggingIn(struct pending_connection *pending, struct client **new_client)
 {
-  // check if server isn't full
-  if (num_of_clients >= MAX_CLIENTS)
+  struct client *cl = pending->client;
+  char *line = pending->secret;
+  pending->secret = NULL;
+
+  char login[LOGIN_SIZE] = {0};
+  bool reserved = false; // place in client list is reserved for this login
+  // re-authentication with session token
+  // t <login> <token>
+  if (pending->stage == HANDSHAKE_LOGIN)
   {
-    printf("BŁĄD: Osiągnięto maksymalną liczbę klientów\n");
-    const char *msg = "Serwer osiągnął maksymalną liczbę klientów. Spróbuj później.";
-    send(*client_socket, msg, strlen(msg), 0);
-    close(*client_socket);
-    return false;
+    char token[TOKEN_SIZE * 2 + 2] = {0};
+    bool authenticated = sscanf(line + 2, "%255s %65s", login, token) == 2 && authenticateToken(login, token);
+    free(line);
+    if (!authenticated)
+    {
+      printf("Nieudane logowanie tokenem na konto '%s'\n", login);
+      return rejectLogin(cl, "Nieprawidłowy lub wygasły token\n");
+    }
   }
   else
   {
-    // allocate client struct
-    struct client *cl = (struct client *)malloc(sizeof(struct client));
-    if (!cl)
+    strcpy(login, cl->login);
+
+    // place in the client list is reserved before hashing, so a login refused
+    // because of full server doesn't cost a hash and doesn't create an account
+    pthread_mutex_lock(&mutex_cl);
+    if (findClientByLoginLocked(login) == NULL)
     {
-      printf("BŁĄD: Nie można zaalokować pamięci dla klienta\n");
-      close(*client_socket);
-      free(cl);
-      return false;
+      if (num_of_clients + reserved_clients >= max_clients)
+      {
+        pthread_mutex_unlock(&mutex_cl);
+        printf("BŁĄD: Osiągnięto maksymalną liczbę klientów\n");
+        return rejectLogin(cl, "Serwer osiągnął maksymalną liczbę klientów. Spróbuj później.\n");
+      }
+      reserved_clients++;
+      reserved = true;
     }
-
-    // set client values
-    cl->socket = *client_socket;
-    cl->is_logged_in = false;
-    memset(cl->login, 0, LOGIN_SIZE);
-
-    // ask for login
-    const char *login_prompt = "Podaj swój login: ";
-    send(*client_socket, login_prompt, strlen(login_prompt), 0);
-
-    char login_buffer[LOGIN_SIZE];
-    int bytes_read = recv(*client_socket, login_buffer, LOGIN_SIZE - 1, 0);
-    if (bytes_read <= 0)
+    pthread_mutex_unlock(&mutex_cl);
+
+    // new login creates an account, otherwise password has to match
+    bool overloaded = false;
+    bool authenticated = authenticatePassword(login, line, &overloaded);
+    memset(line, 0, strlen(line));
+    free(line);
+    if (!authenticated && reserved)
     {
-      printf("Klient rozłączony podczas logowania\n");
-      close(*client_socket);
-      free(cl);
-      return false;
+      pthread_mutex_lock(&mutex_cl);
+      reserved_clients--;
+      pthread_mutex_unlock(&mutex_cl);
     }
-
-    login_buffer[bytes_read] = '\0';
-    // delete newline if exists
-    char *newline = strchr(login_buffer, '\n');
-    if (newline)
-      *newline = '\0';
-
-    // check if user with given login already exist
-    struct client *client = findClientByLogin(login_buffer);
-    // if exist
-    if (client != NULL)
+    if (overloaded)
     {
-      // check if this user is currently logged in
-      // if so deny new connection
-      if (client->is_logged_in)
-      {
-        printf("Klient %s jest juz zalogowany. Odmowa nowego logowania na ten login.\n", client->login);
-        close(*client_socket);
-        free(cl);
-        return false;
-      }
-      // if noone is logged in on that account, log this user onto that account
-      else
-      {
-        pthread_mutex_lock(&mutex_cl);
-        client->is_logged_in = true;
-        // change the previously saved socket to the new one
-        client->socket = cl->socket;
-        pthread_mutex_unlock(&mutex_cl);
-
-        // set the new_client pointer to the current client
-        *new_client = client;
+      printf("Kolejka haszowania haseł jest pełna, odmowa logowania '%s'\n", login);
+      // prompts don't end with newline, BUSY has to start its own line
+      char busy_msg[128] = "\n";
+      busyMessage(busy_msg + 1, sizeof(busy_msg) - 1, 0);
+      return rejectLogin(cl, busy_msg);
+    }
+    if (!authenticated)
+    {
+      printf("Nieudane logowanie na konto '%s'\n", login);
+      return rejectLogin(cl, "Nieprawidłowe hasło\n");
+    }
+  }
 
-        char *msg = "Pomyślnie zalogowano!\n";
-        send(client->socket, msg, strlen(msg), 0);
-        deliverPastMessages(client);
-        return true;
-      }
+  // check if user with given login already exist
+  pthread_mutex_lock(&mutex_cl);
+  if (reserved)
+    reserved_clients--;
+  struct client *client = findClientByLoginLocked(login);
+  // if exist
+  if (client != NULL)
+  {
+    // the caller proved that they own the account, so a session that is still
+    // logged in is a stale one (or the owner moved to another device) - end it
+    if (!takeOverSession(client))
+    {
+      pthread_mutex_unlock(&mutex_cl);
+      printf("Poprzednia sesja klienta '%s' nie zakończyła się. Odmowa nowego logowania.\n", client->login);
+      return rejectLogin(cl, "Ktoś jest już zalogowany na to konto\n");
     }
-    // if login is unique, add the new user to the queue
-    strncpy(cl->login, login_buffer, LOGIN_SIZE - 1);
-    cl->is_logged_in = true;
-    STAILQ_INIT(&cl->queue);
-    client_list[num_of_clients] = cl;
-    num_of_clients++;
-    *new_client = cl;
-
-    // send init message to client
-    printf("Nowy klient zalogowany jako '%s'. Aktywni klienci: %d\n", cl->login, num_of_clients);
-
-    const char *welcome_msg = "Pomyślnie zalogowano! Dostępne komendy:\n"
-                              " m <login> <wiadomość> : wyślij wiadomość do użytkownika\n"
-                              " l : lista zalogowanych użytkowników\n"
-                              " q : wyloguj (rozłącz)\n";
-    send(*client_socket, welcome_msg, strlen(welcome_msg), 0);
+
+    // log this user onto that account
+    client->is_logged_in = true;
+    // change the previously saved socket to the new one
+    client->socket = cl->socket;
+    // keep data that client already sent after login
+    client->reader = cl->reader;
+    pthread_mutex_unlock(&mutex_cl);
+
+    timerCancel(&cl->timer);
+    free(cl);
+    timerArm(&client->timer, client->socket, TIMER_IDLE, IDLE_TIMEOUT_MS);
+
+    // set the new_client pointer to the current client
+    *new_client = client;
+
+    char *msg = "Pomyślnie zalogowano!\n";
+    send(client->socket, msg, strlen(msg), 0);
+    sendSessionToken(client);
+    deliverPastMessages(client);
     return true;
   }
+
+  // check if server isn't full (only new accounts take a place in the list,
+  // password logins have reserved it before hashing)
+  if (!reserved && num_of_clients + reserved_clients >= max_clients)
+  {
+    pthread_mutex_unlock(&mutex_cl);
+    printf("BŁĄD: Osiągnięto maksymalną liczbę klientów\n");
+    return rejectLogin(cl, "Serwer osiągnął maksymalną liczbę klientów. Spróbuj później.\n");
+  }
+
+  // if login is unique, add the new user to the queue
+  strcpy(cl->login, login);
+  cl->is_logged_in = true;
+  STAILQ_INIT(&cl->queue);
+  client_list[num_of_clients] = cl;
+  num_of_clients++;
+  pthread_mutex_unlock(&mutex_cl);
+  timerArm(&cl->timer, cl->socket, TIMER_IDLE, IDLE_TIMEOUT_MS);
+  *new_client = cl;
+
+  // send init message to client
+  printf("Nowy klient zalogowany jako '%s'. Aktywni klienci: %d\n", cl->login, num_of_clients);
+
+  const char *welcome_msg = "Pomyślnie zalogowano! Dostępne komendy:\n"
+                            " m <login> <wiadomość> : wyślij wiadomość do użytkownika\n"
+                            " l : lista zalogowanych użytkowników\n"
+                            " h <login> <n> : ostatnie n wiadomości z użytkownikiem\n"
+                            " h <login> <od> <do> [strona] : wiadomości z zakresu czasu (unix)\n"
+                            " s <słowo> [strona] : szukaj w historii\n"
+                            " q : wyloguj (rozłącz)\n";
+  send(cl->socket, welcome_msg, strlen(welcome_msg), 0);
+  sendSessionToken(cl);
+  return true;
 }
 
 // thread client handler
@@ -293,26 +2124,28 @@ void *clientHandler(void *args)
 
   while (running && server_running)
   {
-    // clear buffer and wait for input from client
-    memset(buffer, 0, BUFFER_SIZE);
-    int bytes_read = recv(client->socket, buffer, BUFFER_SIZE - 1, 0);
+    // wait for next command from client (one command per line)
+    int bytes_read = readLine(client->socket, &client->reader, buffer, BUFFER_SIZE);
 
-    if (bytes_read <= 0)
+    if (bytes_read < 0)
     {
       printf("Klient '%s' rozłączony\n", client->login);
       running = false;
       break;
     }
 
-    buffer[bytes_read] = '\0';
-    // delete newline if exists
-    char *newline = strchr(buffer, '\n');
-    if (newline)
-      *newline = '\0';
+    // any data from client means that connection is alive
+    timerArm(&client->timer, client->socket, TIMER_IDLE, IDLE_TIMEOUT_MS);
 
+    // parse command - heartbeat
+    // empty line or p (sent by older clients), no response
+    if (buffer[0] == '\0' || strcmp(buffer, "p") == 0)
+    {
+      continue;
+    }
     // parse command - message
     // m <login> <message>
-    if (buffer[0] == 'm' && buffer[1] == ' ')
+    else if (buffer[0] == 'm' && buffer[1] == ' ')
     {
       char to_login[LOGIN_SIZE] = {0};
       char message[BUFFER_SIZE] = {0};
@@ -368,19 +2201,69 @@ void *clientHandler(void *args)
     //  sents logged user list to user
     else if (strcmp(buffer, "l") == 0)
     {
-      char users_list[BUFFER_SIZE] = "Zalogowani użytkownicy:\n";
+      // list can be longer than one buffer when there are many clients
       pthread_mutex_lock(&mutex_cl);
-      for (int i = 0; i < num_of_clients; i++)
+      size_t list_size = BUFFER_SIZE + (size_t)num_of_clients * (LOGIN_SIZE + 3);
+      char *users_list = malloc(list_size);
+      size_t list_len = 0;
+      if (users_list)
       {
-        if (client_list[i]->is_logged_in)
+        list_len = snprintf(users_list, list_size, "Zalogowani użytkownicy:\n");
+        for (int i = 0; i < num_of_clients; i++)
         {
-          strcat(users_list, "- ");
-          strcat(users_list, client_list[i]->login);
-          strcat(users_list, "\n");
+          if (client_list[i]->is_logged_in)
+          {
+            list_len += snprintf(users_list + list_len, list_size - list_len, "- %s\n", client_list[i]->login);
+          }
         }
       }
       pthread_mutex_unlock(&mutex_cl);
-      send(client->socket, users_list, strlen(users_list), 0);
+      if (users_list)
+      {
+        send(client->socket, users_list, list_len, 0);
+        free(users_list);
+      }
+    }
+    // parse command, history
+    // h <login> <n> - last n messages
+    // h <login> <from> <to> [page] - messages from time range (unix seconds)
+    else if (buffer[0] == 'h' && buffer[1] == ' ')
+    {
+      char peer[LOGIN_SIZE] = {0};
+      long long from_ts = 0, to_ts = 0, page = 0;
+      int parsed = sscanf(buffer + 2, "%255s %lld %lld %lld", peer, &from_ts, &to_ts, &page);
+      if (parsed == 2 && from_ts > 0)
+      {
+        uint64_t limit = from_ts > HISTORY_MAX_RESULTS ? HISTORY_MAX_RESULTS : from_ts;
+        historyQuery(client->socket, client->login, peer, 0, UINT64_MAX, 0, limit, false);
+      }
+      else if (parsed >= 3 && from_ts >= 0 && to_ts >= from_ts && page >= 0)
+      {
+        historyQuery(client->socket, client->login, peer, (uint64_t)from_ts * 1000,
+                     (uint64_t)to_ts * 1000 + 999, (uint64_t)page * HISTORY_PAGE_SIZE, HISTORY_PAGE_SIZE, true);
+      }
+      else
+      {
+        const char *error_msg = "Błędny format komendy. Użyj: h <login> <n> lub h <login> <od> <do> [strona]\n";
+        send(client->socket, error_msg, strlen(error_msg), 0);
+      }
+    }
+    // parse command, search
+    // s <word> [page]
+    else if (buffer[0] == 's' && buffer[1] == ' ')
+    {
+      char word[LOGIN_SIZE] = {0};
+      long long page = 0;
+      int parsed = sscanf(buffer + 2, "%255s %lld", word, &page);
+      if (parsed >= 1 && page >= 0)
+      {
+        historySearch(client->socket, client->login, word, page);
+      }
+      else
+      {
+        const char *error_msg = "Błędny format komendy. Użyj: s <słowo> [strona]\n";
+        send(client->socket, error_msg, strlen(error_msg), 0);
+      }
     }
     else
     {
@@ -388,6 +2271,9 @@ void *clientHandler(void *args)
       const char *help_msg = "Nieznana komenda. Dostępne komendy:\n"
                              " m <login> <wiadomość> : wyślij wiadomość do użytkownika\n"
                              " l : lista zalogowanych użytkowników\n"
+                             " h <login> <n> : ostatnie n wiadomości z użytkownikiem\n"
+                             " h <login> <od> <do> [strona] : wiadomości z zakresu czasu (unix)\n"
+                             " s <słowo> [strona] : szukaj w historii\n"
                              " q : wyloguj (rozłącz)\n";
       send(client->socket, help_msg, strlen(help_msg), 0);
     }
@@ -397,6 +2283,351 @@ void *clientHandler(void *args)
   return NULL;
 }
 
+// ---------------------------------------------------------------------------
+// Admission control
+//
+// The accept loop also reads login data of new connections (without blocking),
+// so a user who doesn't type doesn't hold any thread. When the login (and the
+// password) arrived, the connection goes to a bounded queue and one of the
+// handshake workers checks the password or token and starts the session.
+// Connections that don't send login data in time are closed by the login timer
+// armed at accept. When the server can't take more connections they are refused
+// right away with "BUSY <retry_after_ms> <jitter_ms> ..." line (also after the
+// login prompts, when login data can't be handled), the client should
+// wait retry_after_ms plus a random part of jitter_ms before reconnecting,
+// so clients that were refused together don't come back together.
+// ---------------------------------------------------------------------------
+
+// connections waiting for login data (used only by the accept loop)
+// poll_fds[0] is the listening socket, poll_fds[i + 1] belongs to waiting[i]
+struct pending_connection *waiting = NULL;
+struct pollfd *poll_fds = NULL;
+int num_waiting = 0;
+
+// ring buffer of connections ready for handshake workers
+struct pending_connection *pending_queue = NULL;
+int pending_head = 0;
+int pending_count = 0;
+// average time a worker spends on one handshake (ms), used to estimate retry hint
+uint64_t handshake_avg_ms = 50;
+
+pthread_mutex_t mutex_pq = PTHREAD_MUTEX_INITIALIZER; // mutex for pending connections queue
+pthread_cond_t cond_pq = PTHREAD_COND_INITIALIZER;    // condition for new pending connection
+
+// Function that writes "server busy" message with retry hint (at least min_retry_ms) into `out`
+void busyMessage(char *out, size_t size, uint64_t min_retry_ms)
+{
+  pthread_mutex_lock(&mutex_pq);
+  // time needed to log in everybody who is already waiting
+  uint64_t retry_after = (uint64_t)(pending_count / handshake_workers + 1) * handshake_avg_ms;
+  pthread_mutex_unlock(&mutex_pq);
+
+  if (retry_after < min_retry_ms)
+    retry_after = min_retry_ms;
+  if (retry_after < RETRY_MIN_MS)
+    retry_after = RETRY_MIN_MS;
+  if (retry_after > RETRY_MAX_MS)
+    retry_after = RETRY_MAX_MS;
+  uint64_t jitter = retry_after;
+
+  snprintf(out, size, "BUSY %llu %llu Serwer jest zajęty, spróbuj ponownie za %llu ms\n",
+           (unsigned long long)retry_after, (unsigned long long)jitter, (unsigned long long)retry_after);
+}
+
+// Function that refuses connection because server is busy
+void refuseBusy(int socket, uint64_t min_retry_ms)
+{
+  char msg[128];
+  busyMessage(msg, sizeof(msg), min_retry_ms);
+  send(socket, msg, strlen(msg), MSG_DONTWAIT);
+  closeGracefully(socket);
+}
+
+// Function that closes connection that is logging in (sends reason if given)
+void dropPending(struct pending_connection *pending, const char *msg)
+{
+  if (pending->secret)
+  {
+    memset(pending->secret, 0, strlen(pending->secret));
+    free(pending->secret);
+    pending->secret = NULL;
+  }
+  rejectLogin(pending->client, msg);
+}
+
+// Function that starts logging in of accepted connection (there must be place in waiting set)
+void startHandshake(int socket)
+{
+  struct client *cl = (struct client *)malloc(sizeof(struct client));
+  if (!cl)
+  {
+    printf("BŁĄD: Nie można zaalokować pamięci dla klienta\n");
+    close(socket);
+    return;
+  }
+  memset(cl, 0, sizeof(struct client));
+  cl->socket = socket;
+  cl->is_logged_in = false;
+
+  // client has limited time to log in, counted from accept
+  timerArm(&cl->timer, socket, TIMER_LOGIN, LOGIN_TIMEOUT_MS);
+
+  // ask for login
+  const char *login_prompt = "Podaj swój login: ";
+  send(socket, login_prompt, strlen(login_prompt), MSG_DONTWAIT);
+
+  struct pending_connection *pending = &waiting[num_waiting];
+  memset(pending, 0, sizeof(struct pending_connection));
+  pending->client = cl;
+  pending->stage = HANDSHAKE_LOGIN;
+  pending->accepted_at = currentTimeMs();
+  poll_fds[num_waiting + 1] = (struct pollfd){socket, POLLIN, 0};
+  num_waiting++;
+}
+
+// Function that reads available login data of waiting connection without blocking
+// returns 1 when login data are complete, 0 when more data are needed and -1 when
+// the connection has to be closed (reason for the client is set if there is one)
+int handshakeRead(struct pending_connection *pending, const char **reason)
+{
+  struct client *cl = pending->client;
+  struct line_reader *reader = &cl->reader;
+  int bytes_read = recv(cl->socket, reader->buffer + reader->length, BUFFER_SIZE - 1 - reader->length, MSG_DONTWAIT);
+  if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+  {
+    printf("Klient rozłączony podczas logowania\n");
+    return -1;
+  }
+  if (bytes_read > 0)
+    reader->length += bytes_read;
+
+  char line[BUFFER_SIZE];
+  int line_len;
+  while ((line_len = takeLine(reader, line, BUFFER_SIZE)) >= 0)
+  {
+    // heartbeat, empty line is never a valid login or password
+    if (line_len == 0)
+      continue;
+
+    // password, or session token instead of login: t <login> <token>
+    if (pending->stage == HANDSHAKE_PASSWORD || (line[0] == 't' && line[1] == ' '))
+    {
+      pending->secret = strdup(line);
+      memset(line, 0, line_len);
+      return pending->secret ? 1 : -1;
+    }
+
+    // login can't contain spaces, they separate command arguments
+    if (strchr(line, ' ') || line_len >= LOGIN_SIZE)
+    {
+      *reason = "Nieprawidłowy login\n";
+      return -1;
+    }
+    strcpy(cl->login, line);
+    pending->stage = HANDSHAKE_PASSWORD;
+
+    // ask for password
+    const char *password_prompt = "Podaj hasło: ";
+    send(cl->socket, password_prompt, strlen(password_prompt), MSG_DONTWAIT);
+  }
+  return 0;
+}
+
+// Function that adds connection with complete login data to the queue, returns false if the queue is full
+bool enqueueConnection(const struct pending_connection *pending)
+{
+  pthread_mutex_lock(&mutex_pq);
+  if (pending_count >= handshake_queue_size)
+  {
+    pthread_mutex_unlock(&mutex_pq);
+    return false;
+  }
+  pending_queue[(pending_head + pending_count) % handshake_queue_size] = *pending;
+  pending_count++;
+  pthread_cond_signal(&cond_pq);
+  pthread_mutex_unlock(&mutex_pq);
+  return true;
+}
+
+// Function that handles poll events of connections waiting for login data
+void handshakeEvents()
+{
+  // backwards, finished connection is replaced by the last one
+  for (int i = num_waiting - 1; i >= 0; i--)
+  {
+    if (poll_fds[i + 1].revents == 0)
+      continue;
+
+    const char *reason = NULL;
+    int state = handshakeRead(&waiting[i], &reason);
+    if (state == 0)
+      continue;
+    if (state < 0)
+    {
+      dropPending(&waiting[i], reason);
+    }
+    else if (!enqueueConnection(&waiting[i]))
+    {
+      printf("Kolejka logowania jest pełna, odmowa logowania (socket %d)\n", waiting[i].client->socket);
+      // prompts don't end with newline, BUSY has to start its own line
+      char busy_msg[128] = "\n";
+      busyMessage(busy_msg + 1, sizeof(busy_msg) - 1, 0);
+      dropPending(&waiting[i], busy_msg);
+    }
+
+    num_waiting--;
+    waiting[i] = waiting[num_waiting];
+    poll_fds[i + 1] = poll_fds[num_waiting + 1];
+  }
+}
+
+// Function that returns time until the oldest waiting connection times out,
+// its place in the waiting set is free at the latest then
+uint64_t waitingRetryMs()
+{
+  uint64_t oldest = UINT64_MAX;
+  for (int i = 0; i < num_waiting; i++)
+  {
+    if (waiting[i].accepted_at < oldest)
+      oldest = waiting[i].accepted_at;
+  }
+  uint64_t now = currentTimeMs();
+  uint64_t deadline = oldest == UINT64_MAX ? now : oldest + LOGIN_TIMEOUT_MS;
+  return deadline > now ? deadline - now : 0;
+}
+
+// thread that logs in connections with complete login data and starts client threads
+void *handshakeWorkerThread(void *args)
+{
+  while (true)
+  {
+    pthread_mutex_lock(&mutex_pq);
+    while (pending_count == 0 && server_running)
+    {
+      pthread_cond_wait(&cond_pq, &mutex_pq);
+    }
+    if (!server_running)
+    {
+      pthread_mutex_unlock(&mutex_pq);
+      break;
+    }
+    struct pending_connection pending = pending_queue[pending_head];
+    pending_head = (pending_head + 1) % handshake_queue_size;
+    pending_count--;
+    pthread_mutex_unlock(&mutex_pq);
+
+    // login timer has already closed the connection while it was waiting in the queue,
+    // don't spend a password hash on it
+    uint64_t started_at = currentTimeMs();
+    if (started_at - pending.accepted_at >= LOGIN_TIMEOUT_MS)
+    {
+      printf("Połączenie czekało na zalogowanie zbyt długo (socket %d)\n", pending.client->socket);
+      dropPending(&pending, NULL);
+      continue;
+    }
+
+    struct client *new_client = NULL;
+    if (handleLoggingIn(&pending, &new_client))
+    {
+      pthread_t client_thread;
+      if (pthread_create(&client_thread, NULL, clientHandler, new_client) != 0)
+      {
+        perror("Nie można utworzyć wątku klienta");
+        removeClient(new_client);
+      }
+      else
+      {
+        pthread_detach(client_thread);
+      }
+    }
+
+    // moving average of handshake time (only work of the server, login data were already received)
+    pthread_mutex_lock(&mutex_pq);
+    handshake_avg_ms = (handshake_avg_ms * 7 + (currentTimeMs() - started_at)) / 8;
+    pthread_mutex_unlock(&mutex_pq);
+  }
+  return NULL;
+}
+
+// Function that starts handshake workers
+bool startHandshakeWorkers()
+{
+  pending_queue = malloc(handshake_queue_size * sizeof(struct pending_connection));
+  waiting = malloc(HANDSHAKE_WAIT_MAX * sizeof(struct pending_connection));
+  poll_fds = malloc((HANDSHAKE_WAIT_MAX + 1) * sizeof(struct pollfd));
+  if (!pending_queue || !waiting || !poll_fds)
+    return false;
+
+  for (int i = 0; i < handshake_workers; i++)
+  {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, handshakeWorkerThread, NULL) != 0)
+      return false;
+    pthread_detach(worker);
+  }
+  return true;
+}
+
+// Function that accepts one connection from nonblocking listening socket
+// returned socket is blocking, -1 with errno EAGAIN when there is nothing to accept
+int acceptConnection(int server_socket, struct sockaddr_in *client_addr)
+{
+  socklen_t client_len = sizeof(*client_addr);
+#ifdef __linux__
+  return accept4(server_socket, (struct sockaddr *)client_addr, &client_len, SOCK_CLOEXEC);
+#else
+  int client_socket = accept(server_socket, (struct sockaddr *)client_addr, &client_len);
+  if (client_socket >= 0)
+  {
+    // BSD sockets inherit O_NONBLOCK from listening socket
+    fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) & ~O_NONBLOCK);
+    fcntl(client_socket, F_SETFD, FD_CLOEXEC);
+  }
+  return client_socket;
+#endif
+}
+
+// Function that raises limit of open files, every client needs one descriptor
+void raiseFileLimit()
+{
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+// Function that sends data to client, connection is shut down if client doesn't
+// receive it in time (so one slow client can't block the delivery thread)
+// send doesn't block, the wait for free space in socket buffer is bounded by poll
+bool sendWithDeadline(int socket, const char *data, size_t len)
+{
+  uint64_t deadline = currentTimeMs() + WRITE_TIMEOUT_MS;
+  size_t sent = 0;
+  while (sent < len)
+  {
+    ssize_t result = send(socket, data + sent, len - sent, MSG_DONTWAIT);
+    if (result > 0)
+    {
+      sent += result;
+      continue;
+    }
+    if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      return false;
+
+    uint64_t now = currentTimeMs();
+    struct pollfd poll_fd = {socket, POLLOUT, 0};
+    if (now >= deadline || poll(&poll_fd, 1, deadline - now) == 0)
+    {
+      printf("Przekroczono czas zapisu, zamykanie połączenia (socket %d)\n", socket);
+      shutdown(socket, SHUT_RDWR);
+      return false;
+    }
+  }
+  return true;
+}
+
 // thread that is delivering messages from queue
 void *messageDeliveryThread(void *args)
 {
@@ -426,23 +2657,49 @@ void *messageDeliveryThread(void *args)
 
     if (message)
     {
-      // find recipient
-      struct client *recipient = findClientByLogin(message->to_login);
-      if (recipient)
+      // find recipient, its socket is duplicated under the lock, so the connection stays
+      // the same even if the recipient logs out and the number is reused by accept
+      int socket = -1;
+      bool kept = false;
+      pthread_mutex_lock(&mutex_cl);
+      struct client *recipient = findClientByLoginLocked(message->to_login);
+      if (recipient && recipient->is_logged_in)
+      {
+        socket = dup(recipient->socket);
+      }
+      else if (recipient)
+      {
+        // recipient logged out after the message was queued, keep it for the next login
+        // (under mutex_cl, so the login can't deliver past messages in the meantime)
+        pthread_mutex_lock(&mutex_mq);
+        STAILQ_INSERT_TAIL(&recipient->queue, message, entries);
+        pthread_mutex_unlock(&mutex_mq);
+        kept = true;
+      }
+      pthread_mutex_unlock(&mutex_cl);
+      if (kept)
+        continue;
+
+      bool delivered = false;
+      if (socket >= 0)
       {
         // format message and send
         char formatted_message[BUFFER_SIZE];
         snprintf(formatted_message, BUFFER_SIZE, "Wiadomość od %s: %s\n",
                  message->from_login, message->message);
 
-        send(recipient->socket, formatted_message, strlen(formatted_message), 0);
-        printf("Dostarczono wiadomość od '%s' do '%s'\n", message->from_login, message->to_login);
+        delivered = sendWithDeadline(socket, formatted_message, strlen(formatted_message));
+        close(socket);
+        if (delivered)
+          printf("Dostarczono wiadomość od '%s' do '%s'\n", message->from_login, message->to_login);
+        else
+          printf("Nie udało się dostarczyć wiadomości od '%s' do '%s'\n", message->from_login, message->to_login);
       }
-      // free memory
-      free(message->from_login);
-      free(message->to_login);
-      free(message->message);
-      free(message);
+      // delivered messages are handed over to the history writer, the rest is freed
+      if (delivered)
+        historyAppend(message);
+      else
+        freeEntry(message);
     }
   }
   return NULL;
@@ -479,21 +2736,79 @@ void cleanup()
   {
     entry = STAILQ_FIRST(&message_queue);
     STAILQ_REMOVE_HEAD(&message_queue, entries);
-    free(entry->from_login);
-    free(entry->to_login);
-    free(entry->message);
-    free(entry);
+    freeEntry(entry);
   }
   pthread_mutex_unlock(&mutex_mq);
+
+  // flush pending history and close history files
+  historyClose();
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+  // parse command line options
+  int option;
+  while ((option = getopt(argc, argv, "p:m:b:q:w:")) != -1)
+  {
+    switch (option)
+    {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'm':
+      max_clients = atoi(optarg);
+      break;
+    case 'b':
+      listen_backlog = atoi(optarg);
+      break;
+    case 'q':
+      handshake_queue_size = atoi(optarg);
+      break;
+    case 'w':
+      handshake_workers = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Użycie: %s [-p port] [-m maks. klientów] [-b backlog] "
+                      "[-q kolejka logowania] [-w wątki logowania]\n",
+              argv[0]);
+      exit(1);
+    }
+  }
+  if (port <= 0 || max_clients <= 0 || listen_backlog <= 0 || handshake_queue_size <= 0 || handshake_workers <= 0)
+  {
+    fprintf(stderr, "Nieprawidłowe ustawienia serwera\n");
+    exit(1);
+  }
+
+  client_list = malloc(max_clients * sizeof(struct client *));
+  if (!client_list)
+  {
+    printf("BŁĄD: Nie można zaalokować listy klientów\n");
+    exit(1);
+  }
+  raiseFileLimit();
+
   // init message queue
   STAILQ_INIT(&message_queue);
 
+  // open message history (server works without it if files are not accessible)
+  if (!historyOpen())
+  {
+    printf("BŁĄD: Historia wiadomości jest niedostępna\n");
+  }
+
+  // load accounts and start password hashing threads
+  loadCredentials();
+  if (!startHashWorkers())
+  {
+    perror("Nie można utworzyć wątków haszujących hasła");
+    exit(1);
+  }
+
   // bind the handle_signal method to signals
   signal(SIGINT, handle_signal);
+  // sending to a connection closed by timeout shouldn't kill the server
+  signal(SIGPIPE, SIG_IGN);
 
   // create server socket
   int server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -516,7 +2831,7 @@ int main()
   struct sockaddr_in server_addr;
   memset(&server_addr, 0, sizeof(server_addr));
   server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(PORT);
+  server_addr.sin_port = htons(port);
   server_addr.sin_addr.s_addr = INADDR_ANY;
 
   // bind socket to addr
@@ -527,15 +2842,28 @@ int main()
     exit(1);
   }
 
-  // listen for connections
-  if (listen(server_socket, 5) < 0)
+  // listen for connections, large backlog keeps connections of a reconnect storm
+  // in the kernel until they are accepted
+  if (listen(server_socket, listen_backlog) < 0)
   {
     perror("Błąd podczas nasłuchiwania");
     close(server_socket);
     exit(1);
   }
 
-  printf("Serwer uruchomiony i nasłuchuje na porcie: %d...\n", PORT);
+  // accept loop drains all waiting connections, so listening socket can't block
+  fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+
+  printf("Serwer uruchomiony i nasłuchuje na porcie: %d...\n", port);
+
+  // start the timer thread (connection timeouts)
+  pthread_t timer_thread;
+  if (pthread_create(&timer_thread, NULL, timerWheelThread, NULL) != 0)
+  {
+    perror("Nie można utworzyć wątku timerów");
+    close(server_socket);
+    exit(1);
+  }
 
   // start the delivery thread
   pthread_t delivery_thread;
@@ -546,44 +2874,75 @@ int main()
     exit(1);
   }
 
+  // start the threads that log in accepted connections
+  if (!startHandshakeWorkers())
+  {
+    perror("Nie można utworzyć wątków logowania");
+    close(server_socket);
+    exit(1);
+  }
+
   // loop that is constantly listening for connection
+  // the same poll waits for new connections and login data of connections that are logging in
+  poll_fds[0] = (struct pollfd){server_socket, POLLIN, 0};
   while (server_running)
   {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-
-    // accept new connection
-    int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
-    if (client_socket < 0)
+    // wait for events (with timeout, so server_running is checked)
+    if (poll(poll_fds, num_waiting + 1, 1000) <= 0)
     {
-      if (server_running)
-      {
-        perror("Błąd podczas akceptowania połączenia");
-      }
       continue;
     }
 
-    // write information about new connection
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
-    printf("Nowe połączenie z %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+    // read login data, connections with complete data go to handshake workers
+    handshakeEvents();
+    if (!(poll_fds[0].revents & POLLIN))
+    {
+      continue;
+    }
 
-    // create new client and create new client handling thread
-    struct client *new_client = NULL;
-    if (handleLoggingIn(&client_socket, &new_client))
+    // accept all waiting connections at once
+    uint64_t waiting_retry_ms = UINT64_MAX; // computed only when needed
+    for (int i = 0; i < ACCEPT_BATCH; i++)
     {
-      pthread_t client_thread;
-      if (pthread_create(&client_thread, NULL, clientHandler, new_client) != 0)
+      struct sockaddr_in client_addr;
+      int client_socket = acceptConnection(server_socket, &client_addr);
+      if (client_socket < 0)
       {
-        perror("Nie można utworzyć wątku klienta");
-        removeClient(new_client);
+        if (errno == EMFILE || errno == ENFILE)
+        {
+          // out of descriptors, give clients time to disconnect
+          perror("Błąd podczas akceptowania połączenia");
+          usleep(100 * 1000);
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                 errno != ECONNABORTED && server_running)
+        {
+          perror("Błąd podczas akceptowania połączenia");
+        }
+        break;
+      }
+
+      // write information about new connection
+      char client_ip[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
+      printf("Nowe połączenie z %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+
+      // if too many connections are logging in, client is told when a place is free
+      if (num_waiting >= HANDSHAKE_WAIT_MAX)
+      {
+        if (waiting_retry_ms == UINT64_MAX)
+          waiting_retry_ms = waitingRetryMs();
+        printf("Zbyt wiele połączeń w trakcie logowania, odmowa połączenia z %s:%d\n", client_ip,
+               ntohs(client_addr.sin_port));
+        refuseBusy(client_socket, waiting_retry_ms);
         continue;
       }
-      pthread_detach(client_thread);
+      startHandshake(client_socket);
     }
   }
 
   pthread_join(delivery_thread, NULL);
+  pthread_join(timer_thread, NULL);
 
   // close server socket
   close(server_socket);